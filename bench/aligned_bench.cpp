@@ -0,0 +1,34 @@
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "bench.hpp"
+#include "smart_pointers.hpp"
+
+namespace {
+
+constexpr size_t kIterations = 5000000;
+
+using Counter = std::atomic<long>;
+
+template <typename Make>
+void BenchPerThreadCounters(const char* name, Make make) {
+  size_t threads = std::max<size_t>(std::thread::hardware_concurrency(), 4);
+  std::vector<SharedPtr<Counter>> counters;
+  for (size_t t = 0; t < threads; ++t) {
+    counters.push_back(make());
+  }
+  RunThreads(name, threads, kIterations, [&](size_t t) {
+    counters[t]->fetch_add(1, std::memory_order_relaxed);
+  });
+}
+
+}  // namespace
+
+int main() {
+  BenchPerThreadCounters("MakeShared per-thread counters",
+                         [] { return MakeShared<Counter>(0); });
+  BenchPerThreadCounters("AllocateSharedAligned(64) per-thread counters",
+                         [] { return AllocateSharedAligned<Counter>(64, 0); });
+}
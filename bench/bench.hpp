@@ -0,0 +1,46 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+template <typename T>
+inline void DoNotOptimize(const T& value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+template <typename Fn>
+void Run(const char* name, size_t iterations, Fn&& fn) {
+  using clock = std::chrono::steady_clock;
+  clock::time_point start = clock::now();
+  for (size_t i = 0; i < iterations; ++i) {
+    fn();
+  }
+  double ns =
+      std::chrono::duration<double, std::nano>(clock::now() - start).count();
+  std::printf("%-44s %9.2f ns/op\n", name, ns / iterations);
+}
+
+template <typename Fn>
+void RunThreads(const char* name, size_t threads, size_t iterations,
+                Fn&& fn) {
+  using clock = std::chrono::steady_clock;
+  std::vector<std::thread> workers;
+  clock::time_point start = clock::now();
+  for (size_t t = 0; t < threads; ++t) {
+    workers.emplace_back([&fn, t, iterations] {
+      for (size_t i = 0; i < iterations; ++i) {
+        fn(t);
+      }
+    });
+  }
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+  double ns =
+      std::chrono::duration<double, std::nano>(clock::now() - start).count();
+  std::printf("%-44s %9.2f ns/op (%zu threads)\n", name, ns / iterations,
+              threads);
+}
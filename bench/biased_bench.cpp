@@ -0,0 +1,49 @@
+#include <thread>
+
+#include "bench.hpp"
+#include "smart_pointers.hpp"
+
+namespace {
+
+constexpr size_t kIterations = 10000000;
+
+template <typename Ptr>
+void BenchOwnerCopies(const char* name, const Ptr& ptr) {
+  Run(name, kIterations, [&] {
+    Ptr copy = ptr;
+    DoNotOptimize(copy);
+  });
+}
+
+void BenchOwnerThread() {
+  BenchOwnerCopies("MakeShared owner copy + release", MakeShared<int>(1));
+  BenchOwnerCopies("MakeSharedBiased owner copy + release",
+                   MakeSharedBiased<int>(1));
+  BenchOwnerCopies("MakeLocalShared copy + release", MakeLocalShared<int>(1));
+}
+
+void BenchOtherThread() {
+  SharedPtr<int> biased = MakeSharedBiased<int>(1);
+  std::thread([&] {
+    BenchOwnerCopies("MakeSharedBiased non-owner copy + release", biased);
+  }).join();
+}
+
+void BenchLock() {
+  SharedPtr<int> biased = MakeSharedBiased<int>(1);
+  WeakPtr<int> weak = biased;
+  Run("MakeSharedBiased owner lock", kIterations,
+      [&] { DoNotOptimize(weak.lock()); });
+  SharedPtr<int> plain = MakeShared<int>(1);
+  WeakPtr<int> plain_weak = plain;
+  Run("MakeShared lock", kIterations,
+      [&] { DoNotOptimize(plain_weak.lock()); });
+}
+
+}  // namespace
+
+int main() {
+  BenchOwnerThread();
+  BenchOtherThread();
+  BenchLock();
+}
@@ -0,0 +1,69 @@
+#include <malloc.h>
+
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "bench.hpp"
+#include "smart_pointers.hpp"
+
+namespace {
+
+constexpr size_t kIterations = 5000000;
+constexpr size_t kLiveObjects = 10000000;
+
+void PrintSizes() {
+  std::printf("%-44s %9zu bytes\n", "SharedPtrPointer<int*> control block",
+              sizeof(SharedPtrPointer<int*, std::default_delete<int>,
+                                      std::allocator<int>>));
+  std::printf("%-44s %9zu bytes\n", "SharedPtrEmplacer<void*> control block",
+              sizeof(SharedPtrEmplacer<void*, std::allocator<void*>>));
+}
+
+size_t HeapInUse() {
+  struct mallinfo2 info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+}
+
+template <typename Ptr, typename Make>
+void BenchLiveSet(const char* name, Make make) {
+  std::vector<Ptr> live;
+  live.reserve(kLiveObjects);
+  size_t heap_before = HeapInUse();
+  Run(name, kLiveObjects, [&] { live.push_back(make()); });
+  std::printf("  %-42s %9.2f bytes/object\n", "heap footprint",
+              static_cast<double>(HeapInUse() - heap_before) / kLiveObjects);
+  size_t index = 0;
+  size_t sum = 0;
+  Run("  read through every pointer", kLiveObjects,
+      [&] { sum += *live[index++]; });
+  DoNotOptimize(sum);
+}
+
+}  // namespace
+
+int main() {
+  // libstdc++ keeps shared_ptr counts non-atomic until a thread exists.
+  std::thread([] {}).join();
+  PrintSizes();
+  Run("SharedPtr<int>(new int)", kIterations,
+      [] { DoNotOptimize(SharedPtr<int>(new int(1))); });
+  Run("std::shared_ptr<int>(new int)", kIterations,
+      [] { DoNotOptimize(std::shared_ptr<int>(new int(1))); });
+  Run("MakeShared<int>", kIterations,
+      [] { DoNotOptimize(MakeShared<int>(1)); });
+  Run("std::make_shared<int>", kIterations,
+      [] { DoNotOptimize(std::make_shared<int>(1)); });
+  std::printf("control block pool: %s\n",
+              SMART_POINTERS_POOL_CONTROL_BLOCKS ? "on" : "off");
+  BenchLiveSet<SharedPtr<int>>("10M live SharedPtr<int>(new int)",
+                               [] { return SharedPtr<int>(new int(1)); });
+  BenchLiveSet<std::shared_ptr<int>>(
+      "10M live std::shared_ptr<int>(new int)",
+      [] { return std::shared_ptr<int>(new int(1)); });
+  BenchLiveSet<SharedPtr<int>>("10M live MakeShared<int>",
+                               [] { return MakeShared<int>(1); });
+  BenchLiveSet<std::shared_ptr<int>>("10M live std::make_shared<int>",
+                                     [] { return std::make_shared<int>(1); });
+}
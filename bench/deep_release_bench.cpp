@@ -0,0 +1,53 @@
+#include <cstdio>
+#include <memory>
+#include <thread>
+
+#include "bench.hpp"
+#include "smart_pointers.hpp"
+
+namespace {
+
+constexpr size_t kShallowLength = 10000;
+constexpr size_t kDeepLength = 1000000;
+
+struct Node {
+  SharedPtr<Node> next;
+};
+
+struct StdNode {
+  std::shared_ptr<StdNode> next;
+};
+
+template <typename Ptr, typename Make>
+void BenchChain(const char* name, size_t length, Make make) {
+  Ptr head;
+  for (size_t i = 0; i < length; ++i) {
+    Ptr node = make();
+    node->next = std::move(head);
+    head = std::move(node);
+  }
+  Run(name, 1, [&] { head = nullptr; });
+}
+
+}  // namespace
+
+int main() {
+  // libstdc++ keeps shared_ptr counts non-atomic until a thread exists.
+  std::thread([] {}).join();
+  std::printf("release mode: %s\n", SMART_POINTERS_ITERATIVE_RELEASE
+                                       ? "iterative past the depth limit"
+                                       : "recursive");
+  BenchChain<SharedPtr<Node>>("release of a 10k SharedPtr chain",
+                              kShallowLength,
+                              [] { return MakeShared<Node>(); });
+  BenchChain<std::shared_ptr<StdNode>>(
+      "release of a 10k std::shared_ptr chain", kShallowLength,
+      [] { return std::make_shared<StdNode>(); });
+  if (SMART_POINTERS_ITERATIVE_RELEASE) {
+    BenchChain<SharedPtr<Node>>("release of a 1M SharedPtr chain",
+                                kDeepLength,
+                                [] { return MakeShared<Node>(); });
+  }
+  Run("MakeShared<Node> + last release", kDeepLength,
+      [] { DoNotOptimize(MakeShared<Node>()); });
+}
@@ -0,0 +1,37 @@
+#include <algorithm>
+#include <thread>
+
+#include "bench.hpp"
+#include "smart_pointers.hpp"
+
+namespace {
+
+constexpr size_t kIterations = 2000000;
+
+struct Config {
+  int value = 1;
+};
+
+size_t ReaderThreads() {
+  return std::max<size_t>(std::thread::hardware_concurrency(), 4);
+}
+
+}  // namespace
+
+int main() {
+  HazardSlot<Config> slot(MakeShared<Config>());
+  Run("HazardSlot::load (locked copy)", kIterations,
+      [&] { DoNotOptimize(slot.load()->value); });
+  HazardPointer hazard;
+  Run("HazardPointer::protect", kIterations,
+      [&] { DoNotOptimize(hazard.protect(slot)->value); });
+  hazard.reset();
+
+  RunThreads("HazardSlot::load readers", ReaderThreads(), kIterations,
+             [&](size_t) { DoNotOptimize(slot.load()->value); });
+  RunThreads("HazardPointer::protect readers", ReaderThreads(), kIterations,
+             [&](size_t) {
+               thread_local HazardPointer reader;
+               DoNotOptimize(reader.protect(slot)->value);
+             });
+}
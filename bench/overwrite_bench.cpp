@@ -0,0 +1,38 @@
+#include <cstdio>
+
+#include "bench.hpp"
+#include "smart_pointers.hpp"
+
+namespace {
+
+constexpr size_t kMiB = 1 << 20;
+constexpr size_t kBufferMiBs[] = {1, 4, 16, 64};
+constexpr size_t kIterations = 2000;
+
+struct Page {
+  char bytes[4096];
+};
+
+void BenchBuffer(size_t mibs) {
+  size_t size = mibs * kMiB;
+  size_t iterations = kIterations / mibs;
+  char name[64];
+  std::snprintf(name, sizeof(name), "MakeShared<char[]>(%zu MiB)", mibs);
+  Run(name, iterations, [size] { DoNotOptimize(MakeShared<char[]>(size)); });
+  std::snprintf(name, sizeof(name), "MakeSharedForOverwrite<char[]>(%zu MiB)",
+                mibs);
+  Run(name, iterations,
+      [size] { DoNotOptimize(MakeSharedForOverwrite<char[]>(size)); });
+}
+
+}  // namespace
+
+int main() {
+  for (size_t mibs : kBufferMiBs) {
+    BenchBuffer(mibs);
+  }
+  Run("MakeShared<Page>()", kIterations * 100,
+      [] { DoNotOptimize(MakeShared<Page>()); });
+  Run("MakeSharedForOverwrite<Page>()", kIterations * 100,
+      [] { DoNotOptimize(MakeSharedForOverwrite<Page>()); });
+}
@@ -0,0 +1,47 @@
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "bench.hpp"
+#include "smart_pointers.hpp"
+
+namespace {
+
+constexpr size_t kIterations = 5000000;
+constexpr size_t kBatch = 1000;
+
+struct Deleter {
+  void operator()(int* ptr) const noexcept { delete ptr; }
+};
+
+void BenchSameThread() {
+  Run("SharedPtr<int>(new int)", kIterations,
+      [] { DoNotOptimize(SharedPtr<int>(new int(1))); });
+  Run("SharedPtr<int>(new int, Deleter)", kIterations,
+      [] { DoNotOptimize(SharedPtr<int>(new int(1), Deleter())); });
+  Run("std::shared_ptr<int>(new int)", kIterations,
+      [] { DoNotOptimize(std::shared_ptr<int>(new int(1))); });
+}
+
+template <typename Ptr>
+void BenchCrossThread(const char* name) {
+  std::vector<Ptr> batch;
+  batch.reserve(kBatch);
+  Run(name, kIterations / kBatch, [&] {
+    for (size_t i = 0; i < kBatch; ++i) {
+      batch.push_back(Ptr(new int(1)));
+    }
+    std::thread([&] { batch.clear(); }).join();
+  });
+}
+
+}  // namespace
+
+int main() {
+  // libstdc++ keeps shared_ptr counts non-atomic until a thread exists.
+  std::thread([] {}).join();
+  BenchSameThread();
+  BenchCrossThread<SharedPtr<int>>("1000 SharedPtr freed on another thread");
+  BenchCrossThread<std::shared_ptr<int>>(
+      "1000 std::shared_ptr freed on another thread");
+}
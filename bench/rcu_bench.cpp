@@ -0,0 +1,47 @@
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "bench.hpp"
+#include "smart_pointers.hpp"
+
+namespace {
+
+constexpr size_t kIterations = 2000000;
+
+struct Config {
+  int value = 1;
+};
+
+size_t ReaderThreads() {
+  return std::max<size_t>(std::thread::hardware_concurrency(), 4);
+}
+
+}  // namespace
+
+int main() {
+  RcuCell<Config> cell(MakeShared<Config>());
+  Run("RcuCell::read", kIterations,
+      [&] { DoNotOptimize(cell.read()->value); });
+  Run("RcuCell::load", kIterations,
+      [&] { DoNotOptimize(cell.load()->value); });
+  Run("RcuCell::update", kIterations / 10,
+      [&] { cell.update([](Config& config) { ++config.value; }); });
+
+  RunThreads("RcuCell::read readers", ReaderThreads(), kIterations,
+             [&](size_t) { DoNotOptimize(cell.read()->value); });
+  RunThreads("RcuCell::load readers", ReaderThreads(), kIterations,
+             [&](size_t) { DoNotOptimize(cell.load()->value); });
+
+  std::atomic<bool> stop{false};
+  std::thread writer([&] {
+    while (!stop.load(std::memory_order_relaxed)) {
+      cell.store(MakeShared<Config>());
+    }
+  });
+  RunThreads("RcuCell::read readers with a writer", ReaderThreads(),
+             kIterations,
+             [&](size_t) { DoNotOptimize(cell.read()->value); });
+  stop = true;
+  writer.join();
+}
@@ -0,0 +1,58 @@
+#include <cstdio>
+#include <memory>
+
+#include "bench.hpp"
+#include "smart_pointers.hpp"
+
+namespace {
+
+constexpr size_t kIterations = 10000000;
+
+void BenchCopyRelease() {
+  SharedPtr<int> ptr = MakeShared<int>(1);
+  Run("SharedPtr copy + release", kIterations, [&] {
+    SharedPtr<int> copy = ptr;
+    DoNotOptimize(copy);
+  });
+  std::shared_ptr<int> std_ptr = std::make_shared<int>(1);
+  Run("std::shared_ptr copy + release", kIterations, [&] {
+    std::shared_ptr<int> copy = std_ptr;
+    DoNotOptimize(copy);
+  });
+}
+
+void BenchLastRelease() {
+  Run("MakeShared + last release", kIterations,
+      [] { DoNotOptimize(MakeShared<int>(1)); });
+  Run("std::make_shared + last release", kIterations,
+      [] { DoNotOptimize(std::make_shared<int>(1)); });
+}
+
+void BenchWeakRelease() {
+  SharedPtr<int> ptr = MakeShared<int>(1);
+  Run("WeakPtr copy + release", kIterations, [&] {
+    WeakPtr<int> weak = ptr;
+    DoNotOptimize(weak);
+  });
+  Run("MakeShared + WeakPtr outliving it", kIterations, [] {
+    WeakPtr<int> weak;
+    {
+      SharedPtr<int> owner = MakeShared<int>(1);
+      weak = owner;
+    }
+    DoNotOptimize(weak);
+  });
+}
+
+}  // namespace
+
+int main() {
+  // libstdc++ keeps shared_ptr counts non-atomic until a thread exists.
+  std::thread([] {}).join();
+  std::printf("release path: %s\n", SMART_POINTERS_FAST_RELEASE
+                                        ? "fast (load before RMW)"
+                                        : "baseline (decrement then check)");
+  BenchCopyRelease();
+  BenchLastRelease();
+  BenchWeakRelease();
+}
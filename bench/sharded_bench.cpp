@@ -0,0 +1,35 @@
+#include <algorithm>
+#include <thread>
+
+#include "bench.hpp"
+#include "smart_pointers.hpp"
+
+namespace {
+
+constexpr size_t kIterations = 2000000;
+
+void BenchContendedCopies(const char* name, size_t threads,
+                          const SharedPtr<int>& ptr) {
+  RunThreads(name, threads, kIterations, [&](size_t) {
+    SharedPtr<int> copy = ptr;
+    DoNotOptimize(copy);
+  });
+}
+
+}  // namespace
+
+int main() {
+  SharedPtr<int> plain = MakeShared<int>(1);
+  ShardedSharedPtr<int> sharded = MakeSharedSharded<int>(1);
+  size_t max_threads =
+      std::max<size_t>(std::thread::hardware_concurrency(), 8);
+  for (size_t threads = 1;; threads = std::min(threads * 2, max_threads)) {
+    BenchContendedCopies("MakeShared contended copy + release", threads,
+                         plain);
+    BenchContendedCopies("MakeSharedSharded contended copy + release",
+                         threads, sharded.share());
+    if (threads == max_threads) {
+      break;
+    }
+  }
+}
@@ -1,8 +1,21 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
 #include <iostream>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <thread>
 #include <type_traits>
 #include <typeinfo>
+#include <vector>
 
 template <typename Alloc>
 class AllocatorDestructor {
@@ -22,528 +35,3709 @@ class AllocatorDestructor {
   size_type size_;
 };
 
+#ifndef SMART_POINTERS_ATOMIC_COUNTS
+#define SMART_POINTERS_ATOMIC_COUNTS 1
+#endif
+
+struct AtomicCountPolicy {
+  using count_type = std::atomic<uint64_t>;
+  static uint64_t load(const count_type& count) noexcept {
+    return count.load(std::memory_order_relaxed);
+  }
+  static uint64_t load_acquire(const count_type& count) noexcept {
+    return count.load(std::memory_order_acquire);
+  }
+  static void increment(count_type& count, uint64_t delta) noexcept {
+    count.fetch_add(delta, std::memory_order_relaxed);
+  }
+  static bool increment_if_nonzero(count_type& count, uint64_t mask,
+                                   uint64_t delta) noexcept {
+    uint64_t current = count.load(std::memory_order_relaxed);
+    while ((current & mask) != 0) {
+      if (count.compare_exchange_weak(current, current + delta,
+                                      std::memory_order_acq_rel,
+                                      std::memory_order_relaxed)) {
+        return true;
+      }
+    }
+    return false;
+  }
+  static uint64_t decrement(count_type& count, uint64_t delta) noexcept {
+    return count.fetch_sub(delta, std::memory_order_acq_rel) - delta;
+  }
+  static uint64_t add(count_type& count, uint64_t delta) noexcept {
+    return count.fetch_add(delta, std::memory_order_acq_rel) + delta;
+  }
+};
+
+struct NonAtomicCountPolicy {
+  using count_type = uint64_t;
+  static uint64_t load(const count_type& count) noexcept { return count; }
+  static uint64_t load_acquire(const count_type& count) noexcept {
+    return count;
+  }
+  static void increment(count_type& count, uint64_t delta) noexcept {
+    count += delta;
+  }
+  static bool increment_if_nonzero(count_type& count, uint64_t mask,
+                                   uint64_t delta) noexcept {
+    if ((count & mask) == 0) {
+      return false;
+    }
+    count += delta;
+    return true;
+  }
+  static uint64_t decrement(count_type& count, uint64_t delta) noexcept {
+    return count -= delta;
+  }
+  static uint64_t add(count_type& count, uint64_t delta) noexcept {
+    return count += delta;
+  }
+};
+
+#if SMART_POINTERS_ATOMIC_COUNTS
+using CountPolicy = AtomicCountPolicy;
+#else
+using CountPolicy = NonAtomicCountPolicy;
+#endif
+
+struct PackedCounts {
+  static constexpr uint64_t kSharedOne = 1;
+  static constexpr uint64_t kWeakOne = uint64_t(1) << 32;
+  static constexpr uint64_t kSharedMask = kWeakOne - 1;
+  static constexpr unsigned kModeShift = 62;
+  static constexpr uint64_t kCountMask = (uint64_t(1) << kModeShift) - 1;
+};
+
+template <typename Count>
+struct ControlBlockOps {
+  using count_type = Count;
+  void (*zero_shared)(Count* count) noexcept;
+  void (*zero_shared_and_weak)(Count* count) noexcept;
+  bool runs_destructors;
+};
+
+class RefCountedBase;
+
+template <typename Block>
+struct ReleaseRunsDestructors
+    : std::integral_constant<bool, !Block::kTrivialZeroShared> {};
+
+template <>
+struct ReleaseRunsDestructors<RefCountedBase> : std::true_type {};
+
+template <typename Block>
+struct ControlBlockOpsFor {
+  using ops_type = typename Block::ops_type;
+  using count_type = typename ops_type::count_type;
+  static void zero_shared(count_type* count) noexcept {
+    static_cast<Block*>(count)->zero_shared();
+  }
+  static void zero_shared_and_weak(count_type* count) noexcept {
+    static_cast<Block*>(count)->zero_shared_and_weak();
+  }
+  static constexpr ops_type kOps = {
+      Block::kTrivialZeroShared ? nullptr : &zero_shared,
+      &zero_shared_and_weak, ReleaseRunsDestructors<Block>::value};
+};
+
+template <typename T>
+class SlabAllocator;
+
+template <typename T>
+class ArenaAllocator;
+
+template <typename Alloc>
+struct HasTrivialDestroy : std::false_type {};
+
+template <typename T>
+struct HasTrivialDestroy<std::allocator<T>> : std::true_type {};
+
+template <typename T>
+struct HasTrivialDestroy<SlabAllocator<T>> : std::true_type {};
+
+template <typename T>
+struct HasTrivialDestroy<ArenaAllocator<T>> : std::true_type {};
+
+template <typename T>
+struct HasTrivialDestroy<std::pmr::polymorphic_allocator<T>>
+    : std::true_type {};
+
+#ifndef SMART_POINTERS_FAST_RELEASE
+#define SMART_POINTERS_FAST_RELEASE 1
+#endif
+
 class SharedCount {
  public:
-  explicit SharedCount(size_t count = 0) noexcept : shared_owners_(count) {}
-  size_t use_count() const noexcept { return shared_owners_; }
-  void add_shared() noexcept { ++shared_owners_; }
+  explicit SharedCount(uint64_t counts = 0) noexcept : counts_(counts) {}
+  size_t use_count() const noexcept {
+    return CountPolicy::load(counts_) & PackedCounts::kSharedMask;
+  }
+  void add_shared() noexcept {
+    CountPolicy::increment(counts_, PackedCounts::kSharedOne);
+  }
+  bool try_add_shared() noexcept {
+    return CountPolicy::increment_if_nonzero(
+        counts_, PackedCounts::kSharedMask, PackedCounts::kSharedOne);
+  }
+  bool decrement_shared() noexcept {
+    return (CountPolicy::decrement(counts_, PackedCounts::kSharedOne) &
+            PackedCounts::kSharedMask) == 0;
+  }
+
+ protected:
+  CountPolicy::count_type counts_;
+};
+
+#ifndef SMART_POINTERS_ITERATIVE_RELEASE
+#define SMART_POINTERS_ITERATIVE_RELEASE 1
+#endif
+
+#ifndef SMART_POINTERS_RELEASE_DEPTH
+#define SMART_POINTERS_RELEASE_DEPTH 128
+#endif
+
+// Releases nest as usual up to kMaxDepth; deeper ones are queued and run
+// once the outermost release returns, which bounds the stack for long
+// chains without reordering ordinary teardown.
+
+class ReleaseQueue {
+ public:
+  template <typename Count>
+  static void release(Count* count, bool last_weak) noexcept;
+
+ private:
+  static constexpr uintptr_t kLastWeak = 1;
+  static constexpr uintptr_t kLocal = 2;
+  static constexpr size_t kMaxDepth = SMART_POINTERS_RELEASE_DEPTH;
+
+  struct Pending {
+    uintptr_t* entries;
+    size_t size;
+    size_t capacity;
+    size_t depth;
+    bool closed;
+  };
+  struct ThreadExit {
+    ~ThreadExit();
+  };
+
+  static bool defer(uintptr_t entry) noexcept;
+  static void finish(uintptr_t entry) noexcept;
+
+  static inline thread_local Pending pending_ = {};
+};
+
+class SharedWeakCount : public SharedCount {
+ public:
+  using ops_type = ControlBlockOps<SharedWeakCount>;
+
+  explicit SharedWeakCount(const ops_type* ops) noexcept
+      : SharedWeakCount(ops, 0, Counting::kPlain) {}
+
+  size_t use_count() const noexcept {
+    return counting() == Counting::kPlain ? SharedCount::use_count()
+                                          : use_count_slow();
+  }
+  void add_shared() noexcept {
+    if (counting() == Counting::kPlain) {
+      SharedCount::add_shared();
+    } else {
+      add_shared_slow();
+    }
+  }
+  bool try_add_shared() noexcept {
+    return counting() == Counting::kPlain ? SharedCount::try_add_shared()
+                                          : try_add_shared_slow();
+  }
+  void add_weak() noexcept {
+    CountPolicy::increment(counts_, PackedCounts::kWeakOne);
+  }
   void release_shared() noexcept {
-    if (shared_owners_ == 0) {
-      zero_shared();
+    uint64_t counts = CountPolicy::load_acquire(counts_);
+    if (kFastRelease &&
+        counts == PackedCounts::kSharedOne + PackedCounts::kWeakOne) {
+      release_last_shared(true);
+    } else if (counting(counts) == Counting::kPlain ? decrement_shared()
+                                                    : decrement_shared_slow()) {
+      release_last_shared(false);
+    }
+  }
+  void release_weak() noexcept {
+    if ((kFastRelease &&
+         (CountPolicy::load_acquire(counts_) & PackedCounts::kCountMask) ==
+             PackedCounts::kWeakOne) ||
+        (CountPolicy::decrement(counts_, PackedCounts::kWeakOne) &
+         PackedCounts::kCountMask) == 0) {
+      zero_shared_and_weak();
+    }
+  }
+  void zero_shared() noexcept {
+    if (ops_->zero_shared != nullptr) {
+      ops_->zero_shared(this);
     }
   }
-  virtual ~SharedCount() = default;
-  virtual void zero_shared() noexcept {};
+  void zero_shared_and_weak() noexcept { ops_->zero_shared_and_weak(this); }
+  bool intrusive() const noexcept;
 
  protected:
-  size_t shared_owners_;
+  enum class Counting : uint64_t { kPlain, kBiased, kSharded };
+
+  // Without the fast path every release decrements first and only then
+  // checks for zero, costing a second RMW when the last owner goes away.
+  static constexpr bool kFastRelease = SMART_POINTERS_FAST_RELEASE;
+
+  SharedWeakCount(const ops_type* ops, size_t count, Counting counting) noexcept
+      : SharedCount(count + PackedCounts::kWeakOne +
+                    (static_cast<uint64_t>(counting)
+                     << PackedCounts::kModeShift)),
+        ops_(ops) {}
+
+  static Counting counting(uint64_t counts) noexcept {
+    return static_cast<Counting>(counts >> PackedCounts::kModeShift);
+  }
+  Counting counting() const noexcept {
+    return counting(CountPolicy::load(counts_));
+  }
+
+ private:
+  size_t use_count_slow() const noexcept;
+  void add_shared_slow() noexcept;
+  bool try_add_shared_slow() noexcept;
+  bool decrement_shared_slow() noexcept;
+
+  friend class ReleaseQueue;
+
+  void release_last_shared(bool last_weak) noexcept {
+    if (ops_->runs_destructors) {
+      ReleaseQueue::release(this, last_weak);
+    } else {
+      finish_release(last_weak);
+    }
+  }
+  void finish_release(bool last_weak) noexcept {
+    zero_shared();
+    if (last_weak) {
+      zero_shared_and_weak();
+    } else {
+      release_weak();
+    }
+  }
+
+  const ops_type* ops_;
 };
 
-class SharedWeakCount : public SharedCount {
+static_assert(sizeof(SharedWeakCount) == sizeof(void*) + sizeof(uint64_t),
+              "counts must stay packed into a single word");
+
+class BiasedSharedWeakCount;
+
+class BiasedCountOwner {
+ public:
+  static BiasedCountOwner* current() noexcept { return current_; }
+  static BiasedCountOwner* acquire_current();
+  void release_ref() noexcept;
+  bool enqueue(BiasedSharedWeakCount* block) noexcept;
+  void drain() noexcept;
+
+ private:
+  struct ThreadExit {
+    ~ThreadExit();
+  };
+
+  static BiasedSharedWeakCount* closed() noexcept {
+    return reinterpret_cast<BiasedSharedWeakCount*>(uintptr_t(1));
+  }
+  static void merge_list(BiasedSharedWeakCount* head) noexcept;
+
+  static inline thread_local BiasedCountOwner* current_ = nullptr;
+  std::atomic<BiasedSharedWeakCount*> queue_{nullptr};
+  std::atomic<size_t> refs_{1};
+};
+
+class BiasedSharedWeakCount : public SharedWeakCount {
+ public:
+  explicit BiasedSharedWeakCount(const ops_type* ops);
+
+ private:
+  friend class SharedWeakCount;
+  friend class BiasedCountOwner;
+
+  static constexpr uint64_t kMergedBit = uint64_t(1) << 63;
+  static constexpr uint64_t kQueuedBit = uint64_t(1) << 62;
+  static constexpr uint64_t kCountMask = kQueuedBit - 1;
+  static constexpr uint64_t kCountBias = uint64_t(1) << 60;
+
+  static int64_t get_shared_count(uint64_t state) noexcept {
+    return static_cast<int64_t>(state & kCountMask) -
+           static_cast<int64_t>(kCountBias);
+  }
+  bool owned_here() const noexcept {
+    return owner_ == BiasedCountOwner::current() &&
+           (state_.load(std::memory_order_relaxed) & kMergedBit) == 0;
+  }
+  bool drain_owner() noexcept;
+  size_t biased_use_count() const noexcept;
+  void add_biased_shared() noexcept;
+  bool try_add_biased_shared() noexcept;
+  bool release_biased_shared() noexcept;
+  bool merge() noexcept;
+
+  BiasedCountOwner* owner_;
+  BiasedSharedWeakCount* next_queued_ = nullptr;
+  std::atomic<size_t> biased_owners_{0};
+  std::atomic<uint64_t> state_{kCountBias};
+};
+
+inline BiasedCountOwner* BiasedCountOwner::acquire_current() {
+  if (current_ == nullptr) {
+    static thread_local ThreadExit thread_exit;
+    current_ = new BiasedCountOwner;
+  } else {
+    current_->drain();
+  }
+  current_->refs_.fetch_add(1, std::memory_order_relaxed);
+  return current_;
+}
+
+inline BiasedCountOwner::ThreadExit::~ThreadExit() {
+  BiasedCountOwner* owner = current_;
+  current_ = nullptr;
+  merge_list(owner->queue_.exchange(closed(), std::memory_order_acq_rel));
+  owner->release_ref();
+}
+
+inline void BiasedCountOwner::release_ref() noexcept {
+  if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    delete this;
+  }
+}
+
+inline bool BiasedCountOwner::enqueue(BiasedSharedWeakCount* block) noexcept {
+  BiasedSharedWeakCount* head = queue_.load(std::memory_order_acquire);
+  do {
+    if (head == closed()) {
+      return false;
+    }
+    block->next_queued_ = head;
+  } while (!queue_.compare_exchange_weak(head, block,
+                                         std::memory_order_release,
+                                         std::memory_order_acquire));
+  return true;
+}
+
+inline void BiasedCountOwner::drain() noexcept {
+  if (queue_.load(std::memory_order_relaxed) != nullptr) {
+    merge_list(queue_.exchange(nullptr, std::memory_order_acquire));
+  }
+}
+
+inline void BiasedCountOwner::merge_list(BiasedSharedWeakCount* head) noexcept {
+  while (head != nullptr) {
+    BiasedSharedWeakCount* next = head->next_queued_;
+    if (head->merge()) {
+      head->zero_shared();
+      head->release_weak();
+    }
+    head->release_weak();
+    head = next;
+  }
+}
+
+inline BiasedSharedWeakCount::BiasedSharedWeakCount(const ops_type* ops)
+    : SharedWeakCount(ops, 0, Counting::kBiased),
+      owner_(BiasedCountOwner::acquire_current()) {}
+
+// Merges blocks released on other threads, which may include this one;
+// returns whether this block is still unmerged afterwards.
+inline bool BiasedSharedWeakCount::drain_owner() noexcept {
+  owner_->drain();
+  return (state_.load(std::memory_order_relaxed) & kMergedBit) == 0;
+}
+
+inline size_t BiasedSharedWeakCount::biased_use_count() const noexcept {
+  uint64_t state = state_.load(std::memory_order_relaxed);
+  int64_t count = get_shared_count(state);
+  if ((state & kMergedBit) == 0) {
+    count += static_cast<int64_t>(
+        biased_owners_.load(std::memory_order_relaxed));
+  }
+  return count > 0 ? static_cast<size_t>(count) : 0;
+}
+
+inline void BiasedSharedWeakCount::add_biased_shared() noexcept {
+  if (owned_here()) {
+    biased_owners_.store(biased_owners_.load(std::memory_order_relaxed) + 1,
+                         std::memory_order_release);
+  } else {
+    state_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+inline bool BiasedSharedWeakCount::try_add_biased_shared() noexcept {
+  if (owned_here() && drain_owner()) {
+    size_t biased = biased_owners_.load(std::memory_order_relaxed);
+    if (static_cast<int64_t>(biased) +
+            get_shared_count(state_.load(std::memory_order_acquire)) <=
+        0) {
+      return false;
+    }
+    biased_owners_.store(biased + 1, std::memory_order_release);
+    return true;
+  }
+  // Until merged, the logical count is split between biased_owners_ and
+  // state_; a block that reached zero waits in its owner's queue and must
+  // not be revived.
+  uint64_t state = state_.load(std::memory_order_acquire);
+  for (;;) {
+    int64_t count = get_shared_count(state);
+    if ((state & kMergedBit) == 0) {
+      count += static_cast<int64_t>(
+          biased_owners_.load(std::memory_order_acquire));
+    }
+    if (count <= 0) {
+      return false;
+    }
+    if (state_.compare_exchange_weak(state, state + 1,
+                                     std::memory_order_acq_rel,
+                                     std::memory_order_relaxed)) {
+      return true;
+    }
+  }
+}
+
+inline bool BiasedSharedWeakCount::release_biased_shared() noexcept {
+  if (owned_here() && drain_owner()) {
+    size_t biased = biased_owners_.load(std::memory_order_relaxed) - 1;
+    biased_owners_.store(biased, std::memory_order_relaxed);
+    return (biased == 0 ||
+            (state_.load(std::memory_order_relaxed) & kQueuedBit) != 0) &&
+           merge();
+  }
+  uint64_t state = state_.fetch_sub(1, std::memory_order_acq_rel);
+  int64_t count = get_shared_count(state) - 1;
+  if ((state & kMergedBit) != 0) {
+    if (count != 0) {
+      return false;
+    }
+    owner_->release_ref();
+    return true;
+  }
+  if (count >= 0 || (state & kQueuedBit) != 0 ||
+      (state_.fetch_or(kQueuedBit, std::memory_order_relaxed) & kQueuedBit) !=
+          0) {
+    return false;
+  }
+  add_weak();
+  if (owner_->enqueue(this)) {
+    return false;
+  }
+  bool dead = merge();
+  release_weak();
+  return dead;
+}
+
+inline bool BiasedSharedWeakCount::merge() noexcept {
+  if ((state_.load(std::memory_order_relaxed) & kMergedBit) != 0) {
+    return false;
+  }
+  size_t biased = biased_owners_.load(std::memory_order_relaxed);
+  biased_owners_.store(0, std::memory_order_relaxed);
+  uint64_t state =
+      state_.fetch_add(biased | kMergedBit, std::memory_order_acq_rel);
+  if (get_shared_count(state) + static_cast<int64_t>(biased) != 0) {
+    return false;
+  }
+  owner_->release_ref();
+  return true;
+}
+
+#ifndef SMART_POINTERS_COUNT_SHARDS
+#define SMART_POINTERS_COUNT_SHARDS 16
+#endif
+
+class ShardedSharedWeakCount : public SharedWeakCount {
  public:
-  explicit SharedWeakCount(size_t count = 0) noexcept
-      : SharedCount(count), shared_weak_owners_(count) {}
+  explicit ShardedSharedWeakCount(const ops_type* ops) noexcept;
+  void collapse() noexcept;
 
-  size_t use_count() const noexcept { return SharedCount::use_count(); }
-  void add_shared() noexcept { SharedCount::add_shared(); }
-  void add_weak() noexcept { ++shared_weak_owners_; }
-  void decrement_weak() noexcept {
-    if (shared_weak_owners_ > 0) {
-      --shared_weak_owners_;
+ private:
+  friend class SharedWeakCount;
+
+  static constexpr size_t kShards = SMART_POINTERS_COUNT_SHARDS;
+  static constexpr int64_t kDeadShard = int64_t(1) << 62;
+  static constexpr size_t kShardBias = size_t(1) << 30;
+
+  struct alignas(64) Shard {
+    std::atomic<int64_t> count{0};
+  };
+
+  static size_t current_shard() noexcept;
+  static bool is_dead(int64_t count) noexcept {
+    return count >= kDeadShard / 2;
+  }
+  size_t sharded_use_count() const noexcept;
+  void add_sharded_shared() noexcept;
+  bool release_sharded_shared() noexcept;
+
+  std::atomic<bool> collapsed_{false};
+  Shard shards_[kShards];
+};
+
+inline ShardedSharedWeakCount::ShardedSharedWeakCount(
+    const ops_type* ops) noexcept
+    : SharedWeakCount(ops, kShardBias, Counting::kSharded) {}
+
+inline size_t ShardedSharedWeakCount::current_shard() noexcept {
+  static std::atomic<size_t> next_shard{0};
+  static thread_local size_t shard =
+      next_shard.fetch_add(1, std::memory_order_relaxed) % kShards;
+  return shard;
+}
+
+inline void ShardedSharedWeakCount::collapse() noexcept {
+  int64_t total = 0;
+  for (Shard& shard : shards_) {
+    total += shard.count.exchange(kDeadShard, std::memory_order_acq_rel);
+  }
+  collapsed_.store(true, std::memory_order_release);
+  uint64_t remaining =
+      CountPolicy::add(counts_, static_cast<uint64_t>(total) - kShardBias) &
+      PackedCounts::kSharedMask;
+  assert(remaining != 0 && "collapse must be called by a live owner");
+  (void)remaining;
+}
+
+inline size_t ShardedSharedWeakCount::sharded_use_count() const noexcept {
+  size_t count = SharedCount::use_count();
+  if (collapsed_.load(std::memory_order_acquire)) {
+    return count;
+  }
+  int64_t total = static_cast<int64_t>(count - kShardBias);
+  for (const Shard& shard : shards_) {
+    int64_t value = shard.count.load(std::memory_order_relaxed);
+    if (is_dead(value)) {
+      return SharedCount::use_count();
     }
+    total += value;
+  }
+  return total > 0 ? static_cast<size_t>(total) : 0;
+}
+
+inline void ShardedSharedWeakCount::add_sharded_shared() noexcept {
+  if (collapsed_.load(std::memory_order_relaxed) ||
+      is_dead(shards_[current_shard()].count.fetch_add(
+          1, std::memory_order_relaxed))) {
+    SharedCount::add_shared();
+  }
+}
+
+inline bool ShardedSharedWeakCount::release_sharded_shared() noexcept {
+  if (!collapsed_.load(std::memory_order_acquire) &&
+      !is_dead(shards_[current_shard()].count.fetch_sub(
+          1, std::memory_order_release))) {
+    return false;
+  }
+  return decrement_shared();
+}
+
+[[gnu::noinline]] inline size_t
+SharedWeakCount::use_count_slow() const noexcept {
+  if (counting() == Counting::kBiased) {
+    return static_cast<const BiasedSharedWeakCount*>(this)->biased_use_count();
+  }
+  return static_cast<const ShardedSharedWeakCount*>(this)->sharded_use_count();
+}
+
+[[gnu::noinline]] inline void
+SharedWeakCount::add_shared_slow() noexcept {
+  if (counting() == Counting::kBiased) {
+    static_cast<BiasedSharedWeakCount*>(this)->add_biased_shared();
+  } else {
+    static_cast<ShardedSharedWeakCount*>(this)->add_sharded_shared();
+  }
+}
+
+[[gnu::noinline]] inline bool
+SharedWeakCount::try_add_shared_slow() noexcept {
+  if (counting() == Counting::kBiased) {
+    return static_cast<BiasedSharedWeakCount*>(this)->try_add_biased_shared();
+  }
+  return SharedCount::try_add_shared();
+}
+
+[[gnu::noinline]] inline bool
+SharedWeakCount::decrement_shared_slow() noexcept {
+  if (counting() == Counting::kBiased) {
+    return static_cast<BiasedSharedWeakCount*>(this)->release_biased_shared();
+  }
+  return static_cast<ShardedSharedWeakCount*>(this)->release_sharded_shared();
+}
+
+class LocalSharedWeakCount {
+ public:
+  using ops_type = ControlBlockOps<LocalSharedWeakCount>;
+
+  explicit LocalSharedWeakCount(const ops_type* ops) noexcept : ops_(ops) {}
+  size_t use_count() const noexcept {
+    return counts_ & PackedCounts::kSharedMask;
+  }
+  void add_shared() noexcept {
+    check_thread();
+    counts_ += PackedCounts::kSharedOne;
   }
-  void decrement_shared() noexcept {
-    if (shared_owners_ > 0) {
-      --shared_owners_;
+  bool try_add_shared() noexcept {
+    check_thread();
+    return NonAtomicCountPolicy::increment_if_nonzero(
+        counts_, PackedCounts::kSharedMask, PackedCounts::kSharedOne);
+  }
+  void add_weak() noexcept {
+    check_thread();
+    counts_ += PackedCounts::kWeakOne;
+  }
+  void release_shared() noexcept {
+    check_thread();
+    if (counts_ == PackedCounts::kSharedOne + PackedCounts::kWeakOne) {
+      release_last_shared(true);
+    } else if (((counts_ -= PackedCounts::kSharedOne) &
+                PackedCounts::kSharedMask) == 0) {
+      release_last_shared(false);
     }
   }
-  void release_shared() noexcept { SharedCount::release_shared(); }
   void release_weak() noexcept {
-    if (shared_weak_owners_ == 0) {
+    check_thread();
+    if ((counts_ -= PackedCounts::kWeakOne) == 0) {
       zero_shared_and_weak();
     }
   }
-  virtual ~SharedWeakCount() = default;
-  virtual void zero_shared_and_weak() noexcept = 0;
+  void zero_shared() noexcept {
+    if (ops_->zero_shared != nullptr) {
+      ops_->zero_shared(this);
+    }
+  }
+  void zero_shared_and_weak() noexcept { ops_->zero_shared_and_weak(this); }
 
  private:
-  size_t shared_weak_owners_ = 0;
+  friend class ReleaseQueue;
+
+  void check_thread() const noexcept {
+    assert(owner_thread_ == std::this_thread::get_id() &&
+           "local pointer used outside of its owning thread");
+  }
+  void release_last_shared(bool last_weak) noexcept {
+    if (ops_->runs_destructors) {
+      ReleaseQueue::release(this, last_weak);
+    } else {
+      finish_release(last_weak);
+    }
+  }
+  void finish_release(bool last_weak) noexcept {
+    zero_shared();
+    if (last_weak) {
+      zero_shared_and_weak();
+    } else {
+      release_weak();
+    }
+  }
+
+  const ops_type* ops_;
+  NonAtomicCountPolicy::count_type counts_ = PackedCounts::kWeakOne;
+#ifndef NDEBUG
+  std::thread::id owner_thread_ = std::this_thread::get_id();
+#endif
 };
 
-template <typename T, typename Deleter, typename Alloc>
-class SharedPtrPointer : public SharedWeakCount {
+template <typename Count>
+void ReleaseQueue::release(Count* count, bool last_weak) noexcept {
+#if SMART_POINTERS_ITERATIVE_RELEASE
+  uintptr_t entry =
+      reinterpret_cast<uintptr_t>(count) | (last_weak ? kLastWeak : 0) |
+      (std::is_same<Count, LocalSharedWeakCount>::value ? kLocal : 0);
+  Pending& pending = pending_;
+  if (pending.depth >= kMaxDepth && defer(entry)) {
+    return;
+  }
+  ++pending.depth;
+  finish(entry);
+  if (pending.depth == 1) {
+    while (pending.size != 0) {
+      finish(pending.entries[--pending.size]);
+    }
+  }
+  --pending.depth;
+#else
+  count->finish_release(last_weak);
+#endif
+}
+
+inline void ReleaseQueue::finish(uintptr_t entry) noexcept {
+  bool last_weak = (entry & kLastWeak) != 0;
+  uintptr_t block = entry & ~(kLastWeak | kLocal);
+  if ((entry & kLocal) != 0) {
+    reinterpret_cast<LocalSharedWeakCount*>(block)->finish_release(last_weak);
+  } else {
+    reinterpret_cast<SharedWeakCount*>(block)->finish_release(last_weak);
+  }
+}
+
+[[gnu::noinline]] inline bool ReleaseQueue::defer(uintptr_t entry) noexcept {
+  Pending& pending = pending_;
+  if (pending.size == pending.capacity) {
+    if (pending.closed) {
+      return false;
+    }
+    static thread_local ThreadExit thread_exit;
+    size_t capacity = pending.capacity != 0 ? pending.capacity * 2 : 64;
+    uintptr_t* entries = new (std::nothrow) uintptr_t[capacity];
+    if (entries == nullptr) {
+      return false;
+    }
+    std::copy(pending.entries, pending.entries + pending.size, entries);
+    delete[] pending.entries;
+    pending.entries = entries;
+    pending.capacity = capacity;
+  }
+  pending.entries[pending.size++] = entry;
+  return true;
+}
+
+inline ReleaseQueue::ThreadExit::~ThreadExit() {
+  delete[] pending_.entries;
+  pending_ = {nullptr, 0, 0, 0, true};
+}
+
+// Objects deriving from RefCountedBase carry their own counts, so the object
+// cannot be destroyed before its storage is released: it lives until the
+// last weak reference is gone. WeakPtr is therefore rejected for them.
+class RefCountedBase : private SharedWeakCount {
  public:
-  explicit SharedPtrPointer(T value, Deleter del, Alloc alloc)
-      : value_(std::move(value)),
-        deleter_(std::move(del)),
-        allocator_(std::move(alloc)) {}
+  RefCountedBase(const RefCountedBase&) noexcept
+      : SharedWeakCount(&ControlBlockOpsFor<RefCountedBase>::kOps) {}
+  RefCountedBase& operator=(const RefCountedBase&) noexcept { return *this; }
 
-  void zero_shared() noexcept override;
-  void zero_shared_and_weak() noexcept override;
+ protected:
+  RefCountedBase() noexcept
+      : SharedWeakCount(&ControlBlockOpsFor<RefCountedBase>::kOps) {}
+  virtual ~RefCountedBase() = default;
 
  private:
-  T value_;
-  Deleter deleter_;
-  Alloc allocator_;
+  template <typename U>
+  friend class IntrusivePtr;
+
+  template <typename U, typename C>
+  friend class BasicSharedPtr;
+
+  friend struct ControlBlockOpsFor<RefCountedBase>;
+
+  static constexpr bool kTrivialZeroShared = true;
+
+  static SharedWeakCount* get_count(const RefCountedBase* base) noexcept {
+    return const_cast<RefCountedBase*>(base);
+  }
+  void zero_shared() noexcept {}
+  void zero_shared_and_weak() noexcept { delete this; }
 };
 
-template <typename T, typename Alloc>
-struct SharedPtrEmplacer : SharedWeakCount {
-  template <typename... Args>
-  explicit SharedPtrEmplacer(Alloc alloc, Args&&... args);
-  Alloc* get_alloc() noexcept { return storage_.get_alloc(); }
-  T* get_elem() noexcept { return storage_.get_elem(); }
-  void zero_shared() noexcept override;
-  void zero_shared_and_weak() noexcept override;
-  ~SharedPtrEmplacer() override = default;
-
- private:
-  using pair = std::pair<Alloc, T>;
-  struct alignas(pair) Storage {
-    Alloc* get_alloc() noexcept;
-    explicit Storage(Alloc&& alloc);
-    ~Storage();
-    T* get_elem() noexcept;
-    char pair_storage[sizeof(pair)];
+inline bool SharedWeakCount::intrusive() const noexcept {
+  return ops_ == &ControlBlockOpsFor<RefCountedBase>::kOps;
+}
+
+#ifndef SMART_POINTERS_POOL_CONTROL_BLOCKS
+#define SMART_POINTERS_POOL_CONTROL_BLOCKS 1
+#endif
+
+#ifndef SMART_POINTERS_POOL_CHUNK_SIZE
+#define SMART_POINTERS_POOL_CHUNK_SIZE (64 * 1024)
+#endif
+
+class ControlBlockPool {
+ public:
+  static constexpr size_t kGranularity = 16;
+  static constexpr size_t kMaxSize = 256;
+  static constexpr size_t kChunkSize = SMART_POINTERS_POOL_CHUNK_SIZE;
+  static_assert((kChunkSize & (kChunkSize - 1)) == 0,
+                "SMART_POINTERS_POOL_CHUNK_SIZE must be a power of two");
+  static_assert(kChunkSize >= kGranularity + kMaxSize,
+                "SMART_POINTERS_POOL_CHUNK_SIZE must fit the largest block");
+
+  static bool pooled(size_t size, size_t align) noexcept {
+    return size != 0 && size <= kMaxSize && align <= kGranularity;
+  }
+  static void* allocate(size_t size);
+  static void deallocate(void* ptr, size_t size) noexcept;
+
+ private:
+  static constexpr size_t kClasses = kMaxSize / kGranularity;
+  // An aligned allocation this large is mmapped with a whole extra
+  // alignment's worth of padding, so chunks are carved from bigger slabs.
+  static constexpr size_t kSlabChunks = 16;
+
+  struct FreeNode {
+    FreeNode* next;
+  };
+  struct alignas(kGranularity) ChunkHeader {
+    ControlBlockPool* owner;
+  };
+  struct ThreadExit {
+    ~ThreadExit();
   };
 
-  static_assert(alignof(Storage) == alignof(pair), "not aligned");
-  static_assert(sizeof(Storage) == sizeof(pair), "not equal size");
-  Storage storage_;
+  static size_t size_class(size_t size) noexcept {
+    return (size - 1) / kGranularity;
+  }
+  static ControlBlockPool* acquire_current();
+  void* allocate_slow(size_t size_class);
+  void push_remote(size_t size_class, FreeNode* node) noexcept;
+
+  static inline thread_local ControlBlockPool* current_ = nullptr;
+  static inline std::mutex orphans_mutex_;
+  static inline ControlBlockPool* orphans_ = nullptr;
+
+  FreeNode* local_[kClasses] = {};
+  std::atomic<FreeNode*> remote_[kClasses] = {};
+  char* bump_ = nullptr;
+  char* bump_end_ = nullptr;
+  char* slab_ = nullptr;
+  char* slab_end_ = nullptr;
+  ControlBlockPool* next_orphan_ = nullptr;
 };
 
-template <typename T, typename Deleter, typename Alloc>
-void SharedPtrPointer<T, Deleter, Alloc>::zero_shared() noexcept {
-  T* value_ptr = std::addressof(value_);
-  deleter_(*value_ptr);
-  deleter_.~Deleter();
+inline void* ControlBlockPool::allocate(size_t size) {
+  ControlBlockPool* pool = current_ != nullptr ? current_ : acquire_current();
+  size_t cls = size_class(size);
+  FreeNode* node = pool->local_[cls];
+  if (node == nullptr) {
+    return pool->allocate_slow(cls);
+  }
+  pool->local_[cls] = node->next;
+  return node;
+}
+
+inline void ControlBlockPool::deallocate(void* ptr, size_t size) noexcept {
+  ChunkHeader* chunk = reinterpret_cast<ChunkHeader*>(
+      reinterpret_cast<uintptr_t>(ptr) & ~uintptr_t(kChunkSize - 1));
+  FreeNode* node = static_cast<FreeNode*>(ptr);
+  size_t cls = size_class(size);
+  if (chunk->owner == current_) {
+    node->next = current_->local_[cls];
+    current_->local_[cls] = node;
+  } else {
+    chunk->owner->push_remote(cls, node);
+  }
+}
+
+inline ControlBlockPool* ControlBlockPool::acquire_current() {
+  static thread_local ThreadExit thread_exit;
+  {
+    std::lock_guard<std::mutex> lock(orphans_mutex_);
+    if (orphans_ != nullptr) {
+      current_ = orphans_;
+      orphans_ = current_->next_orphan_;
+    }
+  }
+  if (current_ == nullptr) {
+    current_ = new ControlBlockPool;
+  }
+  return current_;
+}
+
+inline ControlBlockPool::ThreadExit::~ThreadExit() {
+  ControlBlockPool* pool = current_;
+  current_ = nullptr;
+  std::lock_guard<std::mutex> lock(orphans_mutex_);
+  pool->next_orphan_ = orphans_;
+  orphans_ = pool;
+}
+
+inline void* ControlBlockPool::allocate_slow(size_t size_class) {
+  FreeNode* node = remote_[size_class].exchange(nullptr,
+                                                std::memory_order_acquire);
+  if (node != nullptr) {
+    local_[size_class] = node->next;
+    return node;
+  }
+  size_t bytes = (size_class + 1) * kGranularity;
+  if (static_cast<size_t>(bump_end_ - bump_) < bytes) {
+    if (slab_ == slab_end_) {
+      slab_ = static_cast<char*>(::operator new(
+          kSlabChunks * kChunkSize, std::align_val_t(kChunkSize)));
+      slab_end_ = slab_ + kSlabChunks * kChunkSize;
+    }
+    char* chunk = slab_;
+    slab_ += kChunkSize;
+    ::new (static_cast<void*>(chunk)) ChunkHeader{this};
+    bump_ = chunk + sizeof(ChunkHeader);
+    bump_end_ = chunk + kChunkSize;
+  }
+  void* ptr = bump_;
+  bump_ += bytes;
+  return ptr;
+}
+
+inline void ControlBlockPool::push_remote(size_t size_class,
+                                          FreeNode* node) noexcept {
+  FreeNode* head = remote_[size_class].load(std::memory_order_relaxed);
+  do {
+    node->next = head;
+  } while (!remote_[size_class].compare_exchange_weak(
+      head, node, std::memory_order_release, std::memory_order_relaxed));
+}
+
+template <typename T>
+class ControlBlockPoolAllocator {
+ public:
+  using value_type = T;
+
+  ControlBlockPoolAllocator() noexcept = default;
+  template <typename U>
+  ControlBlockPoolAllocator(const ControlBlockPoolAllocator<U>&) noexcept {}
+
+  T* allocate(size_t count) {
+    if (ControlBlockPool::pooled(count * sizeof(T), alignof(T))) {
+      return static_cast<T*>(ControlBlockPool::allocate(count * sizeof(T)));
+    }
+    return std::allocator<T>().allocate(count);
+  }
+  void deallocate(T* ptr, size_t count) noexcept {
+    if (ControlBlockPool::pooled(count * sizeof(T), alignof(T))) {
+      ControlBlockPool::deallocate(ptr, count * sizeof(T));
+    } else {
+      std::allocator<T>().deallocate(ptr, count);
+    }
+  }
+
+  template <typename U>
+  bool operator==(const ControlBlockPoolAllocator<U>&) const noexcept {
+    return true;
+  }
+  template <typename U>
+  bool operator!=(const ControlBlockPoolAllocator<U>&) const noexcept {
+    return false;
+  }
+};
+
+#ifndef SMART_POINTERS_SLAB_SIZE
+#define SMART_POINTERS_SLAB_SIZE (256 * 1024)
+#endif
+
+template <size_t Size, size_t Align>
+class SlabDepot {
+ public:
+  static constexpr size_t kBatch = 64;
+
+  static void* allocate();
+  static void deallocate(void* ptr) noexcept;
+
+ private:
+  struct FreeNode {
+    FreeNode* next;
+    FreeNode* next_batch;
+    size_t batch_size;
+  };
+  struct Cache {
+    FreeNode* loaded = nullptr;
+    size_t loaded_size = 0;
+    FreeNode* previous = nullptr;
+    size_t previous_size = 0;
+    bool closed = false;
+  };
+  struct ThreadExit {
+    ~ThreadExit();
+  };
+
+  static constexpr size_t kAlign =
+      Align > alignof(FreeNode) ? Align : alignof(FreeNode);
+  static constexpr size_t kSlot =
+      ((Size > sizeof(FreeNode) ? Size : sizeof(FreeNode)) + kAlign - 1) /
+      kAlign * kAlign;
+  static constexpr size_t kBatchesPerSlab =
+      SMART_POINTERS_SLAB_SIZE / (kBatch * kSlot) > 0
+          ? SMART_POINTERS_SLAB_SIZE / (kBatch * kSlot)
+          : 1;
+
+  static SlabDepot& instance();
+  static void open_cache() { static thread_local ThreadExit thread_exit; }
+  FreeNode* take_batch(size_t& size);
+  void give_batch(FreeNode* head, size_t size) noexcept;
+
+  static inline thread_local Cache cache_;
+  std::mutex mutex_;
+  FreeNode* batches_ = nullptr;
+};
+
+template <size_t Size, size_t Align>
+SlabDepot<Size, Align>& SlabDepot<Size, Align>::instance() {
+  static SlabDepot* depot = new SlabDepot;
+  return *depot;
+}
+
+template <size_t Size, size_t Align>
+void* SlabDepot<Size, Align>::allocate() {
+  Cache& cache = cache_;
+  if (cache.closed) {
+    size_t size;
+    FreeNode* node = instance().take_batch(size);
+    if (size > 1) {
+      instance().give_batch(node->next, size - 1);
+    }
+    return node;
+  }
+  if (cache.loaded_size == 0) {
+    if (cache.previous_size != 0) {
+      std::swap(cache.loaded, cache.previous);
+      std::swap(cache.loaded_size, cache.previous_size);
+    } else {
+      open_cache();
+      cache.loaded = instance().take_batch(cache.loaded_size);
+    }
+  }
+  FreeNode* node = cache.loaded;
+  cache.loaded = node->next;
+  --cache.loaded_size;
+  return node;
+}
+
+template <size_t Size, size_t Align>
+void SlabDepot<Size, Align>::deallocate(void* ptr) noexcept {
+  Cache& cache = cache_;
+  if (cache.closed) {
+    FreeNode* node = static_cast<FreeNode*>(ptr);
+    node->next = nullptr;
+    instance().give_batch(node, 1);
+    return;
+  }
+  if (cache.loaded_size == kBatch) {
+    if (cache.previous_size != 0) {
+      instance().give_batch(cache.previous, cache.previous_size);
+    }
+    cache.previous = cache.loaded;
+    cache.previous_size = cache.loaded_size;
+    cache.loaded = nullptr;
+    cache.loaded_size = 0;
+  } else if (cache.loaded_size == 0) {
+    open_cache();
+  }
+  FreeNode* node = static_cast<FreeNode*>(ptr);
+  node->next = cache.loaded;
+  cache.loaded = node;
+  ++cache.loaded_size;
+}
+
+template <size_t Size, size_t Align>
+SlabDepot<Size, Align>::ThreadExit::~ThreadExit() {
+  Cache& cache = cache_;
+  if (cache.loaded_size != 0) {
+    instance().give_batch(cache.loaded, cache.loaded_size);
+  }
+  if (cache.previous_size != 0) {
+    instance().give_batch(cache.previous, cache.previous_size);
+  }
+  cache = {nullptr, 0, nullptr, 0, true};
+}
+
+template <size_t Size, size_t Align>
+typename SlabDepot<Size, Align>::FreeNode* SlabDepot<Size, Align>::take_batch(
+    size_t& size) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (batches_ == nullptr) {
+    char* slab = static_cast<char*>(::operator new(
+        kBatchesPerSlab * kBatch * kSlot, std::align_val_t(kAlign)));
+    for (size_t batch = 0; batch < kBatchesPerSlab; ++batch) {
+      FreeNode* head = nullptr;
+      for (size_t slot = kBatch; slot-- > 0;) {
+        FreeNode* node = reinterpret_cast<FreeNode*>(
+            slab + (batch * kBatch + slot) * kSlot);
+        node->next = head;
+        head = node;
+      }
+      head->next_batch = batches_;
+      head->batch_size = kBatch;
+      batches_ = head;
+    }
+  }
+  FreeNode* head = batches_;
+  batches_ = head->next_batch;
+  size = head->batch_size;
+  return head;
+}
+
+template <size_t Size, size_t Align>
+void SlabDepot<Size, Align>::give_batch(FreeNode* head, size_t size) noexcept {
+  std::lock_guard<std::mutex> lock(mutex_);
+  head->next_batch = batches_;
+  head->batch_size = size;
+  batches_ = head;
+}
+
+template <typename T>
+class SlabAllocator {
+ public:
+  using value_type = T;
+
+  SlabAllocator() noexcept = default;
+  template <typename U>
+  SlabAllocator(const SlabAllocator<U>&) noexcept {}
+
+  T* allocate(size_t count) {
+    if (count == 1) {
+      return static_cast<T*>(depot::allocate());
+    }
+    return std::allocator<T>().allocate(count);
+  }
+  void deallocate(T* ptr, size_t count) noexcept {
+    if (count == 1) {
+      depot::deallocate(ptr);
+    } else {
+      std::allocator<T>().deallocate(ptr, count);
+    }
+  }
+
+  template <typename U>
+  bool operator==(const SlabAllocator<U>&) const noexcept {
+    return true;
+  }
+  template <typename U>
+  bool operator!=(const SlabAllocator<U>&) const noexcept {
+    return false;
+  }
+
+ private:
+  using depot = SlabDepot<sizeof(T), alignof(T)>;
+};
+
+template <typename T>
+struct UseSlabAllocator : std::false_type {};
+
+class Arena {
+ public:
+  static constexpr size_t kDefaultChunkSize = 64 * 1024;
+
+  explicit Arena(size_t chunk_size = kDefaultChunkSize) noexcept
+      : chunk_size_(chunk_size) {}
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+  ~Arena() { release(); }
+  void* allocate(size_t size, size_t align);
+  void release() noexcept;
+
+ private:
+  template <typename T>
+  friend class ArenaAllocator;
+
+  struct alignas(std::max_align_t) Chunk {
+    Chunk* next;
+  };
+
+  void note_deallocate() noexcept {
+#ifndef NDEBUG
+    live_.fetch_sub(1, std::memory_order_release);
+#endif
+  }
+
+  Chunk* chunks_ = nullptr;
+  char* current_ = nullptr;
+  char* end_ = nullptr;
+  size_t chunk_size_;
+#ifndef NDEBUG
+  std::atomic<size_t> live_{0};
+#endif
+};
+
+inline void* Arena::allocate(size_t size, size_t align) {
+  uintptr_t mask = ~uintptr_t(align - 1);
+  uintptr_t aligned =
+      (reinterpret_cast<uintptr_t>(current_) + align - 1) & mask;
+  if (current_ == nullptr ||
+      aligned + size > reinterpret_cast<uintptr_t>(end_)) {
+    size_t needed = sizeof(Chunk) + size + align;
+    size_t bytes = needed > chunk_size_ ? needed : chunk_size_;
+    Chunk* chunk = static_cast<Chunk*>(::operator new(bytes));
+    chunk->next = chunks_;
+    chunks_ = chunk;
+    current_ = reinterpret_cast<char*>(chunk + 1);
+    end_ = reinterpret_cast<char*>(chunk) + bytes;
+    aligned = (reinterpret_cast<uintptr_t>(current_) + align - 1) & mask;
+  }
+  current_ = reinterpret_cast<char*>(aligned + size);
+#ifndef NDEBUG
+  live_.fetch_add(1, std::memory_order_relaxed);
+#endif
+  return reinterpret_cast<void*>(aligned);
+}
+
+inline void Arena::release() noexcept {
+  assert(live_.load(std::memory_order_acquire) == 0 &&
+         "arena released while shared or weak references are alive");
+  while (chunks_ != nullptr) {
+    Chunk* next = chunks_->next;
+    ::operator delete(chunks_);
+    chunks_ = next;
+  }
+  current_ = nullptr;
+  end_ = nullptr;
+}
+
+template <typename T>
+class ArenaAllocator {
+ public:
+  using value_type = T;
+
+  explicit ArenaAllocator(Arena& arena) noexcept : arena_(&arena) {}
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U>& other) noexcept
+      : arena_(other.arena_) {}
+
+  T* allocate(size_t count) {
+    return static_cast<T*>(arena_->allocate(count * sizeof(T), alignof(T)));
+  }
+  void deallocate(T*, size_t) noexcept { arena_->note_deallocate(); }
+
+  template <typename U>
+  bool operator==(const ArenaAllocator<U>& other) const noexcept {
+    return arena_ == other.arena_;
+  }
+  template <typename U>
+  bool operator!=(const ArenaAllocator<U>& other) const noexcept {
+    return arena_ != other.arena_;
+  }
+
+ private:
+  template <typename U>
+  friend class ArenaAllocator;
+
+  Arena* arena_;
+};
+
+template <typename T>
+using MakeSharedAllocator = typename std::conditional<
+    UseSlabAllocator<T>::value,
+    SlabAllocator<typename std::remove_extent<T>::type>,
+    std::allocator<typename std::remove_extent<T>::type>>::type;
+
+template <typename T, int Index = 0,
+          bool = std::is_empty<T>::value && !std::is_final<T>::value>
+class CompressedElement {
+ public:
+  explicit CompressedElement(T value) : value_(std::move(value)) {}
+  T& get() noexcept { return value_; }
+
+ private:
+  T value_;
+};
+
+template <typename T, int Index>
+class CompressedElement<T, Index, true> : private T {
+ public:
+  explicit CompressedElement(T value) : T(std::move(value)) {}
+  T& get() noexcept { return *this; }
+};
+
+template <typename T, typename Deleter, typename Alloc,
+          typename Count = SharedWeakCount>
+class SharedPtrPointer : public Count,
+                         private CompressedElement<Deleter, 0>,
+                         private CompressedElement<Alloc, 1> {
+ public:
+  static constexpr bool kTrivialZeroShared = false;
+
+  explicit SharedPtrPointer(T value, Deleter del, Alloc alloc)
+      : Count(&ControlBlockOpsFor<SharedPtrPointer>::kOps),
+        CompressedElement<Deleter, 0>(std::move(del)),
+        CompressedElement<Alloc, 1>(std::move(alloc)),
+        value_(std::move(value)) {}
+
+  void zero_shared() noexcept;
+  void zero_shared_and_weak() noexcept;
+
+ private:
+  Deleter& deleter() noexcept {
+    return CompressedElement<Deleter, 0>::get();
+  }
+  Alloc& allocator() noexcept { return CompressedElement<Alloc, 1>::get(); }
+
+  T value_;
+};
+
+struct SharedPtrForOverwriteTag {};
+
+template <typename T, typename Alloc, typename Count = SharedWeakCount>
+struct SharedPtrEmplacer : Count {
+  static constexpr bool kTrivialZeroShared =
+      std::is_trivially_destructible<T>::value &&
+      HasTrivialDestroy<Alloc>::value;
+
+  template <typename... Args>
+  explicit SharedPtrEmplacer(Alloc alloc, Args&&... args);
+  SharedPtrEmplacer(Alloc alloc, SharedPtrForOverwriteTag);
+  Alloc* get_alloc() noexcept { return std::addressof(storage_.get()); }
+  T* get_elem() noexcept { return storage_.get_elem(); }
+  void zero_shared() noexcept;
+  void zero_shared_and_weak() noexcept;
+
+ private:
+  struct Storage : CompressedElement<Alloc> {
+    explicit Storage(Alloc&& alloc)
+        : CompressedElement<Alloc>(std::move(alloc)) {}
+    T* get_elem() noexcept { return reinterpret_cast<T*>(elem_storage); }
+    alignas(T) char elem_storage[sizeof(T)];
+  };
+
+  Storage storage_;
+};
+
+template <typename T, typename Alloc, typename Count = SharedWeakCount>
+struct SharedPtrArrayEmplacer : Count, private CompressedElement<Alloc> {
+  using element_type = typename std::remove_extent<T>::type;
+  static_assert(!std::is_array<element_type>::value,
+                "multidimensional arrays are not supported");
+  static constexpr bool kTrivialZeroShared =
+      std::is_trivially_destructible<element_type>::value &&
+      HasTrivialDestroy<Alloc>::value;
+
+  template <typename... Args>
+  SharedPtrArrayEmplacer(Alloc alloc, size_t size, const Args&... args);
+  SharedPtrArrayEmplacer(Alloc alloc, size_t size, SharedPtrForOverwriteTag);
+  element_type* get_elem() noexcept;
+  size_t size() const noexcept { return size_; }
+  static size_t max_size() noexcept;
+  static size_t storage_units(size_t size) noexcept;
+  void zero_shared() noexcept;
+  void zero_shared_and_weak() noexcept;
+
+  static constexpr size_t kHeaderAlign =
+      alignof(Count) > alignof(Alloc) ? alignof(Count) : alignof(Alloc);
+  static constexpr size_t kAlign = kHeaderAlign > alignof(element_type)
+                                       ? kHeaderAlign
+                                       : alignof(element_type);
+  using storage_unit = typename std::aligned_storage<kAlign, kAlign>::type;
+
+ private:
+  static size_t elements_offset() noexcept;
+  void destroy_elements(size_t count) noexcept;
+  Alloc& alloc() noexcept { return CompressedElement<Alloc>::get(); }
+
+  size_t size_;
+};
+
+template <typename T, typename Count = SharedWeakCount>
+struct SharedPtrAlignedEmplacer : Count {
+  static constexpr bool kTrivialZeroShared =
+      std::is_trivially_destructible<T>::value;
+
+  template <typename... Args>
+  explicit SharedPtrAlignedEmplacer(size_t alignment, Args&&... args);
+  T* get_elem() noexcept;
+  static size_t block_alignment(size_t alignment) noexcept;
+  static size_t allocation_size(size_t alignment) noexcept;
+  void zero_shared() noexcept;
+  void zero_shared_and_weak() noexcept;
+
+ private:
+  static size_t element_offset(size_t alignment) noexcept;
+
+  size_t alignment_;
+};
+
+template <typename T, typename Deleter, typename Alloc, typename Count>
+void SharedPtrPointer<T, Deleter, Alloc, Count>::zero_shared() noexcept {
+  T* value_ptr = std::addressof(value_);
+  deleter()(*value_ptr);
+  deleter().~Deleter();
+}
+
+template <typename T, typename Deleter, typename Alloc, typename Count>
+void SharedPtrPointer<T, Deleter, Alloc,
+                      Count>::zero_shared_and_weak() noexcept {
+  using custom_alloc = typename std::allocator_traits<
+      Alloc>::template rebind_alloc<SharedPtrPointer>;
+  using custom_traits = std::allocator_traits<custom_alloc>;
+  using pointer_traits = std::pointer_traits<typename custom_traits::pointer>;
+  custom_alloc alloc(allocator());
+  allocator().~Alloc();
+  alloc.deallocate(pointer_traits::pointer_to(*this), 1);
+}
+
+template <typename T, typename Alloc, typename Count>
+template <typename... Args>
+SharedPtrEmplacer<T, Alloc, Count>::SharedPtrEmplacer(Alloc alloc,
+                                                      Args&&... args)
+    : Count(&ControlBlockOpsFor<SharedPtrEmplacer>::kOps),
+      storage_(std::move(alloc)) {
+  using type_alloc =
+      typename std::allocator_traits<Alloc>::template rebind_alloc<T>;
+  type_alloc temp(*get_alloc());
+  std::allocator_traits<type_alloc>::construct(temp, get_elem(),
+                                               std::forward<Args>(args)...);
+}
+
+template <typename T, typename Alloc, typename Count>
+SharedPtrEmplacer<T, Alloc, Count>::SharedPtrEmplacer(Alloc alloc,
+                                                      SharedPtrForOverwriteTag)
+    : Count(&ControlBlockOpsFor<SharedPtrEmplacer>::kOps),
+      storage_(std::move(alloc)) {
+  ::new (static_cast<void*>(get_elem())) T;
+}
+
+template <typename T, typename Alloc, typename Count>
+void SharedPtrEmplacer<T, Alloc, Count>::zero_shared() noexcept {
+  using type_alloc =
+      typename std::allocator_traits<Alloc>::template rebind_alloc<T>;
+  type_alloc temp(*get_alloc());
+  std::allocator_traits<type_alloc>::destroy(temp, get_elem());
+}
+
+template <typename T, typename Alloc, typename Count>
+void SharedPtrEmplacer<T, Alloc, Count>::zero_shared_and_weak() noexcept {
+  using control_block_alloc = typename std::allocator_traits<
+      Alloc>::template rebind_alloc<SharedPtrEmplacer>;
+  using control_block_pointer =
+      typename std::allocator_traits<control_block_alloc>::pointer;
+  control_block_alloc temp(*get_alloc());
+  storage_.~Storage();
+  std::allocator_traits<control_block_alloc>::deallocate(
+      temp, std::pointer_traits<control_block_pointer>::pointer_to(*this), 1);
+}
+
+template <typename T, typename Alloc, typename Count>
+template <typename... Args>
+SharedPtrArrayEmplacer<T, Alloc, Count>::SharedPtrArrayEmplacer(
+    Alloc alloc, size_t size, const Args&... args)
+    : Count(&ControlBlockOpsFor<SharedPtrArrayEmplacer>::kOps),
+      CompressedElement<Alloc>(std::move(alloc)),
+      size_(size) {
+  using type_alloc = typename std::allocator_traits<
+      Alloc>::template rebind_alloc<element_type>;
+  type_alloc temp(this->alloc());
+  element_type* elems = get_elem();
+  size_t constructed = 0;
+  try {
+    for (; constructed < size_; ++constructed) {
+      std::allocator_traits<type_alloc>::construct(temp, elems + constructed,
+                                                   args...);
+    }
+  } catch (...) {
+    destroy_elements(constructed);
+    throw;
+  }
+}
+
+template <typename T, typename Alloc, typename Count>
+SharedPtrArrayEmplacer<T, Alloc, Count>::SharedPtrArrayEmplacer(
+    Alloc alloc, size_t size, SharedPtrForOverwriteTag)
+    : Count(&ControlBlockOpsFor<SharedPtrArrayEmplacer>::kOps),
+      CompressedElement<Alloc>(std::move(alloc)),
+      size_(size) {
+  element_type* elems = get_elem();
+  size_t constructed = 0;
+  try {
+    for (; constructed < size_; ++constructed) {
+      ::new (static_cast<void*>(elems + constructed)) element_type;
+    }
+  } catch (...) {
+    destroy_elements(constructed);
+    throw;
+  }
+}
+
+template <typename T, typename Alloc, typename Count>
+size_t SharedPtrArrayEmplacer<T, Alloc, Count>::elements_offset() noexcept {
+  constexpr size_t align = alignof(element_type);
+  return (sizeof(SharedPtrArrayEmplacer) + align - 1) / align * align;
+}
+
+template <typename T, typename Alloc, typename Count>
+size_t SharedPtrArrayEmplacer<T, Alloc, Count>::max_size() noexcept {
+  return (SIZE_MAX - elements_offset() - (sizeof(storage_unit) - 1)) /
+         sizeof(element_type);
+}
+
+template <typename T, typename Alloc, typename Count>
+size_t SharedPtrArrayEmplacer<T, Alloc, Count>::storage_units(
+    size_t size) noexcept {
+  size_t bytes = elements_offset() + size * sizeof(element_type);
+  return (bytes + sizeof(storage_unit) - 1) / sizeof(storage_unit);
+}
+
+template <typename T, typename Alloc, typename Count>
+typename SharedPtrArrayEmplacer<T, Alloc, Count>::element_type*
+SharedPtrArrayEmplacer<T, Alloc, Count>::get_elem() noexcept {
+  return reinterpret_cast<element_type*>(reinterpret_cast<char*>(this) +
+                                         elements_offset());
+}
+
+template <typename T, typename Alloc, typename Count>
+void SharedPtrArrayEmplacer<T, Alloc, Count>::destroy_elements(
+    size_t count) noexcept {
+  using type_alloc = typename std::allocator_traits<
+      Alloc>::template rebind_alloc<element_type>;
+  type_alloc temp(alloc());
+  element_type* elems = get_elem();
+  while (count != 0) {
+    std::allocator_traits<type_alloc>::destroy(temp, elems + --count);
+  }
+}
+
+template <typename T, typename Alloc, typename Count>
+void SharedPtrArrayEmplacer<T, Alloc, Count>::zero_shared() noexcept {
+  destroy_elements(size_);
+}
+
+template <typename T, typename Alloc, typename Count>
+void SharedPtrArrayEmplacer<T, Alloc,
+                            Count>::zero_shared_and_weak() noexcept {
+  using unit_alloc = typename std::allocator_traits<
+      Alloc>::template rebind_alloc<storage_unit>;
+  using unit_pointer = typename std::allocator_traits<unit_alloc>::pointer;
+  unit_alloc temp(alloc());
+  size_t units = storage_units(size_);
+  alloc().~Alloc();
+  std::allocator_traits<unit_alloc>::deallocate(
+      temp,
+      std::pointer_traits<unit_pointer>::pointer_to(
+          *reinterpret_cast<storage_unit*>(this)),
+      units);
+}
+
+template <typename T, typename Count>
+template <typename... Args>
+SharedPtrAlignedEmplacer<T, Count>::SharedPtrAlignedEmplacer(size_t alignment,
+                                                             Args&&... args)
+    : Count(&ControlBlockOpsFor<SharedPtrAlignedEmplacer>::kOps),
+      alignment_(alignment) {
+  ::new (static_cast<void*>(get_elem())) T(std::forward<Args>(args)...);
+}
+
+template <typename T, typename Count>
+size_t SharedPtrAlignedEmplacer<T, Count>::block_alignment(
+    size_t alignment) noexcept {
+  assert((alignment & (alignment - 1)) == 0 &&
+         "alignment must be a power of two");
+  constexpr size_t min_align = alignof(SharedPtrAlignedEmplacer) > alignof(T)
+                                   ? alignof(SharedPtrAlignedEmplacer)
+                                   : alignof(T);
+  return alignment > min_align ? alignment : min_align;
+}
+
+template <typename T, typename Count>
+size_t SharedPtrAlignedEmplacer<T, Count>::element_offset(
+    size_t alignment) noexcept {
+  return (sizeof(SharedPtrAlignedEmplacer) + alignment - 1) / alignment *
+         alignment;
+}
+
+template <typename T, typename Count>
+size_t SharedPtrAlignedEmplacer<T, Count>::allocation_size(
+    size_t alignment) noexcept {
+  return (element_offset(alignment) + sizeof(T) + alignment - 1) / alignment *
+         alignment;
+}
+
+template <typename T, typename Count>
+T* SharedPtrAlignedEmplacer<T, Count>::get_elem() noexcept {
+  return reinterpret_cast<T*>(reinterpret_cast<char*>(this) +
+                              element_offset(alignment_));
+}
+
+template <typename T, typename Count>
+void SharedPtrAlignedEmplacer<T, Count>::zero_shared() noexcept {
+  get_elem()->~T();
+}
+
+template <typename T, typename Count>
+void SharedPtrAlignedEmplacer<T, Count>::zero_shared_and_weak() noexcept {
+  size_t alignment = alignment_;
+  ::operator delete(static_cast<void*>(this), allocation_size(alignment),
+                    std::align_val_t(alignment));
+}
+
+static_assert(sizeof(SharedPtrPointer<int*, std::default_delete<int>,
+                                     std::allocator<int>>) ==
+                  sizeof(SharedWeakCount) + sizeof(int*),
+              "empty deleter and allocator must not take space");
+static_assert(sizeof(SharedPtrEmplacer<void*, std::allocator<void*>>) ==
+                  sizeof(SharedWeakCount) + sizeof(void*),
+              "empty allocator must not take space");
+static_assert(
+    sizeof(SharedPtrEmplacer<void*, std::pmr::polymorphic_allocator<void*>>) ==
+        sizeof(SharedWeakCount) + 2 * sizeof(void*),
+    "polymorphic allocator must store only the resource pointer");
+
+template <typename T, typename Count>
+class BasicSharedPtr;
+
+template <typename T, typename Count>
+class BasicWeakPtr;
+
+template <typename T>
+class EnableSharedFromThis;
+
+template <typename T>
+using SharedPtr = BasicSharedPtr<T, SharedWeakCount>;
+
+template <typename T>
+using WeakPtr = BasicWeakPtr<T, SharedWeakCount>;
+
+template <typename T>
+using LocalSharedPtr = BasicSharedPtr<T, LocalSharedWeakCount>;
+
+template <typename T>
+using LocalWeakPtr = BasicWeakPtr<T, LocalSharedWeakCount>;
+
+template <typename T, typename Count>
+class BasicSharedPtr {
+ public:
+  using element_type = typename std::remove_extent<T>::type;
+
+  BasicSharedPtr() noexcept {}
+  BasicSharedPtr(std::nullptr_t) {}
+  template <typename Y>
+  explicit BasicSharedPtr(Y* ptr);
+  BasicSharedPtr(const BasicSharedPtr& other) noexcept;
+  BasicSharedPtr(BasicSharedPtr&& other) noexcept;
+  template <typename Y>
+  BasicSharedPtr(const BasicSharedPtr<Y, Count>& other) noexcept;
+  template <typename Y>
+  BasicSharedPtr(BasicSharedPtr<Y, Count>&& other) noexcept;
+  template <typename Y>
+  BasicSharedPtr(const BasicSharedPtr<Y, Count>& other,
+                 element_type* ptr) noexcept;
+  template <typename Y>
+  BasicSharedPtr(BasicSharedPtr<Y, Count>&& other, element_type* ptr) noexcept;
+  template <typename Y, typename Deleter>
+  BasicSharedPtr(Y* ptr, Deleter del);
+  template <typename Y, typename Deleter, typename Alloc>
+  BasicSharedPtr(Y* ptr, Deleter del, Alloc alloc);
+  BasicSharedPtr& operator=(const BasicSharedPtr& other) noexcept;
+  BasicSharedPtr& operator=(BasicSharedPtr&& other) noexcept;
+  template <typename Y>
+  BasicSharedPtr& operator=(const BasicSharedPtr<Y, Count>& other) noexcept;
+  template <typename Y>
+  BasicSharedPtr& operator=(BasicSharedPtr<Y, Count>&& other) noexcept;
+  ~BasicSharedPtr();
+  size_t use_count() const noexcept;
+  element_type* get() const noexcept;
+  typename std::add_lvalue_reference<element_type>::type operator*()
+      const noexcept;
+  element_type* operator->() const noexcept;
+  typename std::add_lvalue_reference<element_type>::type operator[](
+      std::ptrdiff_t index) const noexcept;
+  void reset() noexcept;
+
+ private:
+  template <typename Y, typename ControlBlock>
+  static BasicSharedPtr create_with_control_block(
+      Y* ptr, ControlBlock* block) noexcept;
+  template <typename Y, typename Deleter, typename Alloc>
+  static Count* create_pointer_block(Y* ptr, Deleter del, Alloc alloc);
+  template <typename U>
+  struct SharedPtrDefaultAllocator {
+#if SMART_POINTERS_POOL_CONTROL_BLOCKS
+    using type = ControlBlockPoolAllocator<U>;
+#else
+    using type = std::allocator<U>;
+#endif
+  };
+
+  template <typename U, typename Y>
+  struct SharedPtrDefaultDeleter
+      : std::conditional<std::is_array<U>::value, std::default_delete<Y[]>,
+                         std::default_delete<Y>>::type {};
+
+  template <typename U, typename C>
+  friend class BasicWeakPtr;
+
+  template <typename Ptr, typename ControlBlock, typename Alloc,
+            typename... Args>
+  friend Ptr AllocateSharedControlBlock(const Alloc& alloc, Args&&... args);
+
+  template <typename Ptr, typename ControlBlock, typename Alloc,
+            typename... Args>
+  friend Ptr AllocateSharedArrayControlBlock(const Alloc& alloc, size_t size,
+                                             const Args&... args);
+
+  template <typename Ptr, typename ControlBlock, typename... Args>
+  friend Ptr AllocateSharedAlignedControlBlock(size_t alignment,
+                                               Args&&... args);
+
+  template <typename U, typename C>
+  friend class BasicSharedPtr;
+
+  template <typename U>
+  friend class AtomicSharedPtr;
+
+  template <typename U>
+  friend class HazardSlot;
+
+  template <typename U>
+  friend class RcuCell;
+
+  template <typename U>
+  friend class ShardedSharedPtr;
+
+  template <typename U>
+  friend class ThinSharedPtr;
+
+  template <typename Y, typename U>
+  void enable_weak_this(const EnableSharedFromThis<U>* base,
+                        Y* ptr) noexcept;
+  void enable_weak_this(...) noexcept {}
+
+  void swap(BasicSharedPtr& other) noexcept;
+  element_type* element_ptr_ = nullptr;
+  Count* control_ptr_ = nullptr;
+};
+
+template <typename T, typename Count>
+template <typename Y>
+BasicSharedPtr<T, Count>::BasicSharedPtr(Y* ptr) : element_ptr_(ptr) {
+  if constexpr (std::is_base_of<RefCountedBase, Y>::value &&
+                std::is_same<Count, SharedWeakCount>::value &&
+                !std::is_array<T>::value) {
+    if (ptr == nullptr) {
+      return;
+    }
+    control_ptr_ = RefCountedBase::get_count(ptr);
+  } else {
+    using alloc_t = typename SharedPtrDefaultAllocator<Y>::type;
+    control_ptr_ =
+        create_pointer_block(ptr, SharedPtrDefaultDeleter<T, Y>(), alloc_t());
+  }
+  control_ptr_->add_shared();
+  enable_weak_this(ptr, ptr);
+}
+
+template <typename T, typename Count>
+template <typename Y, typename Deleter>
+BasicSharedPtr<T, Count>::BasicSharedPtr(Y* ptr, Deleter del)
+    : element_ptr_(ptr) {
+  using alloc_t = typename SharedPtrDefaultAllocator<Y>::type;
+  control_ptr_ = create_pointer_block(ptr, std::move(del), alloc_t());
+  control_ptr_->add_shared();
+  enable_weak_this(ptr, ptr);
+}
+
+template <typename T, typename Count>
+template <typename Y, typename Deleter, typename Alloc>
+BasicSharedPtr<T, Count>::BasicSharedPtr(Y* ptr, Deleter del, Alloc alloc)
+    : element_ptr_(ptr) {
+  control_ptr_ = create_pointer_block(ptr, std::move(del), std::move(alloc));
+  control_ptr_->add_shared();
+  enable_weak_this(ptr, ptr);
+}
+
+template <typename T, typename Count>
+template <typename Y, typename Deleter, typename Alloc>
+Count* BasicSharedPtr<T, Count>::create_pointer_block(Y* ptr, Deleter del,
+                                                      Alloc alloc) {
+  using control_block = SharedPtrPointer<Y*, Deleter, Alloc, Count>;
+  using rebinded_alloc = typename std::allocator_traits<
+      Alloc>::template rebind_alloc<control_block>;
+  using rebinded_traits = std::allocator_traits<rebinded_alloc>;
+  rebinded_alloc rebinded(alloc);
+  control_block* block = nullptr;
+  try {
+    block = rebinded_traits::allocate(rebinded, 1);
+    rebinded_traits::construct(rebinded, block, ptr, std::move(del), alloc);
+  } catch (...) {
+    if (block != nullptr) {
+      rebinded_traits::deallocate(rebinded, block, 1);
+    }
+    del(ptr);
+    throw;
+  }
+  return block;
+}
+
+template <typename T, typename Count>
+BasicSharedPtr<T, Count>::BasicSharedPtr(const BasicSharedPtr& other) noexcept
+    : element_ptr_(other.element_ptr_), control_ptr_(other.control_ptr_) {
+  if (control_ptr_ != nullptr) {
+    control_ptr_->add_shared();
+  }
+}
+
+template <typename T, typename Count>
+template <typename Y>
+BasicSharedPtr<T, Count>::BasicSharedPtr(
+    const BasicSharedPtr<Y, Count>& other) noexcept
+    : element_ptr_(other.element_ptr_), control_ptr_(other.control_ptr_) {
+  if (control_ptr_ != nullptr) {
+    control_ptr_->add_shared();
+  }
+}
+
+template <typename T, typename Count>
+BasicSharedPtr<T, Count>::BasicSharedPtr(BasicSharedPtr&& other) noexcept
+    : element_ptr_(other.element_ptr_), control_ptr_(other.control_ptr_) {
+  other.element_ptr_ = nullptr;
+  other.control_ptr_ = nullptr;
+}
+
+template <typename T, typename Count>
+template <typename Y>
+BasicSharedPtr<T, Count>::BasicSharedPtr(
+    BasicSharedPtr<Y, Count>&& other) noexcept
+    : element_ptr_(other.element_ptr_), control_ptr_(other.control_ptr_) {
+  other.element_ptr_ = nullptr;
+  other.control_ptr_ = nullptr;
+}
+
+template <typename T, typename Count>
+template <typename Y>
+BasicSharedPtr<T, Count>::BasicSharedPtr(const BasicSharedPtr<Y, Count>& other,
+                                         element_type* ptr) noexcept
+    : element_ptr_(ptr), control_ptr_(other.control_ptr_) {
+  if (control_ptr_ != nullptr) {
+    control_ptr_->add_shared();
+  }
+}
+
+template <typename T, typename Count>
+template <typename Y>
+BasicSharedPtr<T, Count>::BasicSharedPtr(BasicSharedPtr<Y, Count>&& other,
+                                         element_type* ptr) noexcept
+    : element_ptr_(ptr), control_ptr_(other.control_ptr_) {
+  other.element_ptr_ = nullptr;
+  other.control_ptr_ = nullptr;
+}
+
+template <typename T, typename Count>
+BasicSharedPtr<T, Count>::~BasicSharedPtr() {
+  if (control_ptr_ != nullptr) {
+    control_ptr_->release_shared();
+  }
+  control_ptr_ = nullptr;
+}
+
+template <typename T, typename Count>
+void BasicSharedPtr<T, Count>::swap(BasicSharedPtr<T, Count>& other) noexcept {
+  std::swap(element_ptr_, other.element_ptr_);
+  std::swap(control_ptr_, other.control_ptr_);
+}
+
+template <typename T, typename Count>
+BasicSharedPtr<T, Count>& BasicSharedPtr<T, Count>::operator=(
+    const BasicSharedPtr& other) noexcept {
+  BasicSharedPtr(other).swap(*this);
+  return *this;
+}
+
+template <typename T, typename Count>
+template <typename Y>
+BasicSharedPtr<T, Count>& BasicSharedPtr<T, Count>::operator=(
+    const BasicSharedPtr<Y, Count>& other) noexcept {
+  BasicSharedPtr(other).swap(*this);
+  return *this;
+}
+
+template <typename T, typename Count>
+BasicSharedPtr<T, Count>& BasicSharedPtr<T, Count>::operator=(
+    BasicSharedPtr&& other) noexcept {
+  BasicSharedPtr(std::move(other)).swap(*this);
+  return *this;
+}
+
+template <typename T, typename Count>
+template <typename Y>
+BasicSharedPtr<T, Count>& BasicSharedPtr<T, Count>::operator=(
+    BasicSharedPtr<Y, Count>&& other) noexcept {
+  BasicSharedPtr(std::move(other)).swap(*this);
+  return *this;
+}
+
+template <typename T, typename Count>
+void BasicSharedPtr<T, Count>::reset() noexcept {
+  BasicSharedPtr().swap(*this);
+}
+
+template <typename T, typename Count>
+typename BasicSharedPtr<T, Count>::element_type*
+BasicSharedPtr<T, Count>::get() const noexcept {
+  return element_ptr_;
+}
+
+template <typename T, typename Count>
+typename std::add_lvalue_reference<
+    typename BasicSharedPtr<T, Count>::element_type>::type
+BasicSharedPtr<T, Count>::operator*() const noexcept {
+  return *element_ptr_;
+}
+
+template <typename T, typename Count>
+typename BasicSharedPtr<T, Count>::element_type*
+BasicSharedPtr<T, Count>::operator->() const noexcept {
+  return element_ptr_;
+}
+
+template <typename T, typename Count>
+typename std::add_lvalue_reference<
+    typename BasicSharedPtr<T, Count>::element_type>::type
+BasicSharedPtr<T, Count>::operator[](std::ptrdiff_t index) const noexcept {
+  return element_ptr_[index];
+}
+
+template <typename T, typename Count>
+size_t BasicSharedPtr<T, Count>::use_count() const noexcept {
+  return control_ptr_ != nullptr ? control_ptr_->use_count() : 0;
+}
+
+template <typename T, typename Count>
+template <typename Y, typename ControlBlock>
+BasicSharedPtr<T, Count> BasicSharedPtr<T, Count>::create_with_control_block(
+    Y* ptr, ControlBlock* block) noexcept {
+  BasicSharedPtr<T, Count> smart_ptr;
+  smart_ptr.element_ptr_ = ptr;
+  smart_ptr.control_ptr_ = block;
+  smart_ptr.control_ptr_->add_shared();
+  smart_ptr.enable_weak_this(ptr, ptr);
+  return smart_ptr;
+}
+
+template <typename T, typename Count>
+template <typename Y, typename U>
+void BasicSharedPtr<T, Count>::enable_weak_this(
+    const EnableSharedFromThis<U>* base, Y* ptr) noexcept {
+  static_assert(!std::is_base_of<RefCountedBase, Y>::value,
+                "RefCountedBase types can already be shared from this");
+  if constexpr (std::is_same<Count, SharedWeakCount>::value &&
+                !std::is_array<T>::value) {
+    if (base != nullptr && base->weak_this_.expired()) {
+      WeakPtr<U> weak_this;
+      weak_this.element_ptr_ = static_cast<U*>(
+          const_cast<typename std::remove_cv<Y>::type*>(ptr));
+      weak_this.control_ptr_ = control_ptr_;
+      control_ptr_->add_weak();
+      base->weak_this_ = std::move(weak_this);
+    }
+  }
+}
+
+template <typename Ptr, typename ControlBlock, typename Alloc,
+          typename... Args>
+Ptr AllocateSharedControlBlock(const Alloc& alloc, Args&&... args) {
+  using cntrl_allocator = typename std::allocator_traits<
+      Alloc>::template rebind_alloc<ControlBlock>;
+  using cntrl_traits = std::allocator_traits<cntrl_allocator>;
+  cntrl_allocator control_alloc(alloc);
+  ControlBlock* block = reinterpret_cast<ControlBlock*>(
+      cntrl_traits::allocate(control_alloc, 1));
+  assert(reinterpret_cast<uintptr_t>(block) % alignof(ControlBlock) == 0 &&
+         "allocator ignored the control block alignment");
+  try {
+    ::new (reinterpret_cast<ControlBlock*>(block))
+        ControlBlock(alloc, std::forward<Args>(args)...);
+  } catch (...) {
+    cntrl_traits::deallocate(control_alloc, block, 1);
+    throw;
+  }
+  return Ptr::create_with_control_block((*block).get_elem(),
+                                        std::addressof(*block));
+}
+
+template <typename Ptr, typename ControlBlock, typename Alloc,
+          typename... Args>
+Ptr AllocateSharedArrayControlBlock(const Alloc& alloc, size_t size,
+                                    const Args&... args) {
+  using unit = typename ControlBlock::storage_unit;
+  using unit_allocator =
+      typename std::allocator_traits<Alloc>::template rebind_alloc<unit>;
+  using unit_traits = std::allocator_traits<unit_allocator>;
+  if (size > ControlBlock::max_size()) {
+    throw std::bad_array_new_length();
+  }
+  unit_allocator unit_alloc(alloc);
+  size_t units = ControlBlock::storage_units(size);
+  unit* storage = unit_traits::allocate(unit_alloc, units);
+  ControlBlock* block = reinterpret_cast<ControlBlock*>(storage);
+  try {
+    ::new (block) ControlBlock(alloc, size, args...);
+  } catch (...) {
+    unit_traits::deallocate(unit_alloc, storage, units);
+    throw;
+  }
+  return Ptr::create_with_control_block(block->get_elem(), block);
+}
+
+template <typename Ptr, typename ControlBlock, typename... Args>
+Ptr AllocateSharedAlignedControlBlock(size_t alignment, Args&&... args) {
+  alignment = ControlBlock::block_alignment(alignment);
+  size_t size = ControlBlock::allocation_size(alignment);
+  void* storage = ::operator new(size, std::align_val_t(alignment));
+  ControlBlock* block;
+  try {
+    block =
+        ::new (storage) ControlBlock(alignment, std::forward<Args>(args)...);
+  } catch (...) {
+    ::operator delete(storage, size, std::align_val_t(alignment));
+    throw;
+  }
+  return Ptr::create_with_control_block(block->get_elem(), block);
+}
+
+template <typename T, typename Alloc, typename... Args>
+SharedPtr<T> AllocateShared(const Alloc& alloc, Args&&... args) {
+  if constexpr (std::is_array<T>::value) {
+    using control_block = SharedPtrArrayEmplacer<T, Alloc>;
+    if constexpr (std::extent<T>::value != 0) {
+      return AllocateSharedArrayControlBlock<SharedPtr<T>, control_block>(
+          alloc, std::extent<T>::value, args...);
+    } else {
+      return AllocateSharedArrayControlBlock<SharedPtr<T>, control_block>(
+          alloc, args...);
+    }
+  } else {
+    using control_block = SharedPtrEmplacer<T, Alloc>;
+    return AllocateSharedControlBlock<SharedPtr<T>, control_block>(
+        alloc, std::forward<Args>(args)...);
+  }
+}
+
+template <typename T, typename... Args>
+SharedPtr<T> MakeShared(Args&&... args) {
+  using elem_alloc = MakeSharedAllocator<T>;
+  return AllocateShared<T>(elem_alloc(), std::forward<Args>(args)...);
+}
+
+template <typename T, typename... Args>
+SharedPtr<T> AllocateSharedAligned(size_t alignment, Args&&... args) {
+  static_assert(!std::is_array<T>::value, "arrays are not supported");
+  using control_block = SharedPtrAlignedEmplacer<T>;
+  return AllocateSharedAlignedControlBlock<SharedPtr<T>, control_block>(
+      alignment, std::forward<Args>(args)...);
+}
+
+template <typename T, typename... Args>
+SharedPtr<T> AllocateSharedPmr(std::pmr::memory_resource* resource,
+                               Args&&... args) {
+  using elem_alloc =
+      std::pmr::polymorphic_allocator<typename std::remove_extent<T>::type>;
+  return AllocateShared<T>(elem_alloc(resource), std::forward<Args>(args)...);
+}
+
+template <typename T, typename Alloc>
+SharedPtr<T> AllocateSharedForOverwrite(const Alloc& alloc) {
+  static_assert(!std::is_array<T>::value || std::extent<T>::value != 0,
+                "arrays of unknown bound need a size");
+  return AllocateShared<T>(alloc, SharedPtrForOverwriteTag());
+}
+
+template <typename T, typename Alloc>
+SharedPtr<T> AllocateSharedForOverwrite(const Alloc& alloc, size_t size) {
+  static_assert(std::is_array<T>::value && std::extent<T>::value == 0,
+                "only arrays of unknown bound take a size");
+  return AllocateShared<T>(alloc, size, SharedPtrForOverwriteTag());
+}
+
+template <typename T>
+SharedPtr<T> MakeSharedForOverwrite() {
+  using elem_alloc = MakeSharedAllocator<T>;
+  return AllocateSharedForOverwrite<T>(elem_alloc());
+}
+
+template <typename T>
+SharedPtr<T> MakeSharedForOverwrite(size_t size) {
+  using elem_alloc = MakeSharedAllocator<T>;
+  return AllocateSharedForOverwrite<T>(elem_alloc(), size);
+}
+
+template <typename T, typename Alloc, typename... Args>
+LocalSharedPtr<T> AllocateLocalShared(const Alloc& alloc, Args&&... args) {
+  using control_block = SharedPtrEmplacer<T, Alloc, LocalSharedWeakCount>;
+  return AllocateSharedControlBlock<LocalSharedPtr<T>, control_block>(
+      alloc, std::forward<Args>(args)...);
+}
+
+template <typename T, typename... Args>
+LocalSharedPtr<T> MakeLocalShared(Args&&... args) {
+  return AllocateLocalShared<T>(std::allocator<T>(),
+                                std::forward<Args>(args)...);
+}
+
+template <typename T, typename Alloc, typename... Args>
+SharedPtr<T> AllocateSharedBiased(const Alloc& alloc, Args&&... args) {
+  using control_block = SharedPtrEmplacer<T, Alloc, BiasedSharedWeakCount>;
+  return AllocateSharedControlBlock<SharedPtr<T>, control_block>(
+      alloc, std::forward<Args>(args)...);
+}
+
+template <typename T, typename... Args>
+SharedPtr<T> MakeSharedBiased(Args&&... args) {
+  return AllocateSharedBiased<T>(std::allocator<T>(),
+                                 std::forward<Args>(args)...);
+}
+
+template <typename T>
+class ShardedSharedPtr {
+ public:
+  ShardedSharedPtr() noexcept = default;
+  ShardedSharedPtr(const ShardedSharedPtr&) = delete;
+  ShardedSharedPtr(ShardedSharedPtr&& other) noexcept = default;
+  ShardedSharedPtr& operator=(const ShardedSharedPtr&) = delete;
+  ShardedSharedPtr& operator=(ShardedSharedPtr&& other) noexcept;
+  ~ShardedSharedPtr() { reset(); }
+  SharedPtr<T> share() const noexcept { return ptr_; }
+  size_t use_count() const noexcept { return ptr_.use_count(); }
+  T* get() const noexcept { return ptr_.get(); }
+  typename std::add_lvalue_reference<T>::type operator*() const noexcept {
+    return *ptr_;
+  }
+  T* operator->() const noexcept { return ptr_.get(); }
+  void reset() noexcept;
+
+ private:
+  template <typename Y, typename Alloc, typename... Args>
+  friend ShardedSharedPtr<Y> AllocateSharedSharded(const Alloc& alloc,
+                                                   Args&&... args);
+
+  explicit ShardedSharedPtr(SharedPtr<T>&& ptr) noexcept
+      : ptr_(std::move(ptr)) {}
+
+  SharedPtr<T> ptr_;
+};
+
+template <typename T>
+ShardedSharedPtr<T>& ShardedSharedPtr<T>::operator=(
+    ShardedSharedPtr&& other) noexcept {
+  if (this != &other) {
+    reset();
+    ptr_ = std::move(other.ptr_);
+  }
+  return *this;
+}
+
+template <typename T>
+void ShardedSharedPtr<T>::reset() noexcept {
+  if (ptr_.control_ptr_ != nullptr) {
+    static_cast<ShardedSharedWeakCount*>(ptr_.control_ptr_)->collapse();
+    ptr_.reset();
+  }
+}
+
+template <typename T, typename Alloc, typename... Args>
+ShardedSharedPtr<T> AllocateSharedSharded(const Alloc& alloc,
+                                          Args&&... args) {
+  using control_block = SharedPtrEmplacer<T, Alloc, ShardedSharedWeakCount>;
+  return ShardedSharedPtr<T>(
+      AllocateSharedControlBlock<SharedPtr<T>, control_block>(
+          alloc, std::forward<Args>(args)...));
+}
+
+template <typename T, typename... Args>
+ShardedSharedPtr<T> MakeSharedSharded(Args&&... args) {
+  return AllocateSharedSharded<T>(std::allocator<T>(),
+                                  std::forward<Args>(args)...);
+}
+
+template <typename T>
+class ThinWeakPtr;
+
+template <typename T>
+class ThinSharedPtr {
+ public:
+  ThinSharedPtr() noexcept = default;
+  ThinSharedPtr(std::nullptr_t) noexcept {}
+  ThinSharedPtr(const ThinSharedPtr& other) noexcept;
+  ThinSharedPtr(ThinSharedPtr&& other) noexcept;
+  ThinSharedPtr& operator=(const ThinSharedPtr& other) noexcept;
+  ThinSharedPtr& operator=(ThinSharedPtr&& other) noexcept;
+  ~ThinSharedPtr();
+  size_t use_count() const noexcept;
+  T* get() const noexcept;
+  T& operator*() const noexcept { return *get(); }
+  T* operator->() const noexcept { return get(); }
+  SharedPtr<T> share() const noexcept;
+  void reset() noexcept;
+
+ private:
+  static_assert(!std::is_array<T>::value, "arrays are not supported");
+
+  template <typename Y, typename Alloc, typename... Args>
+  friend ThinSharedPtr<Y> AllocateSharedThin(const Alloc& alloc,
+                                             Args&&... args);
+
+  friend class ThinWeakPtr<T>;
+
+  static constexpr size_t kElementOffset =
+      (sizeof(SharedWeakCount) + alignof(T) - 1) / alignof(T) * alignof(T);
+
+  explicit ThinSharedPtr(SharedPtr<T>&& ptr) noexcept;
+  void swap(ThinSharedPtr& other) noexcept {
+    std::swap(control_ptr_, other.control_ptr_);
+  }
+
+  SharedWeakCount* control_ptr_ = nullptr;
+};
+
+static_assert(sizeof(ThinSharedPtr<int>) == sizeof(void*),
+              "thin pointers must hold only the control block");
+
+template <typename T>
+ThinSharedPtr<T>::ThinSharedPtr(SharedPtr<T>&& ptr) noexcept
+    : control_ptr_(ptr.control_ptr_) {
+  assert(get() == ptr.get() && "element is not at the thin offset");
+  ptr.element_ptr_ = nullptr;
+  ptr.control_ptr_ = nullptr;
+}
+
+template <typename T>
+ThinSharedPtr<T>::ThinSharedPtr(const ThinSharedPtr& other) noexcept
+    : control_ptr_(other.control_ptr_) {
+  if (control_ptr_ != nullptr) {
+    control_ptr_->add_shared();
+  }
+}
+
+template <typename T>
+ThinSharedPtr<T>::ThinSharedPtr(ThinSharedPtr&& other) noexcept
+    : control_ptr_(other.control_ptr_) {
+  other.control_ptr_ = nullptr;
+}
+
+template <typename T>
+ThinSharedPtr<T>& ThinSharedPtr<T>::operator=(
+    const ThinSharedPtr& other) noexcept {
+  ThinSharedPtr(other).swap(*this);
+  return *this;
+}
+
+template <typename T>
+ThinSharedPtr<T>& ThinSharedPtr<T>::operator=(ThinSharedPtr&& other) noexcept {
+  ThinSharedPtr(std::move(other)).swap(*this);
+  return *this;
+}
+
+template <typename T>
+ThinSharedPtr<T>::~ThinSharedPtr() {
+  if (control_ptr_ != nullptr) {
+    control_ptr_->release_shared();
+  }
+}
+
+template <typename T>
+size_t ThinSharedPtr<T>::use_count() const noexcept {
+  return control_ptr_ != nullptr ? control_ptr_->use_count() : 0;
+}
+
+template <typename T>
+T* ThinSharedPtr<T>::get() const noexcept {
+  if (control_ptr_ == nullptr) {
+    return nullptr;
+  }
+  return reinterpret_cast<T*>(reinterpret_cast<char*>(control_ptr_) +
+                              kElementOffset);
+}
+
+template <typename T>
+SharedPtr<T> ThinSharedPtr<T>::share() const noexcept {
+  SharedPtr<T> ptr;
+  if (control_ptr_ != nullptr) {
+    control_ptr_->add_shared();
+    ptr.element_ptr_ = get();
+    ptr.control_ptr_ = control_ptr_;
+  }
+  return ptr;
+}
+
+template <typename T>
+void ThinSharedPtr<T>::reset() noexcept {
+  ThinSharedPtr().swap(*this);
+}
+
+template <typename T, typename Alloc, typename... Args>
+ThinSharedPtr<T> AllocateSharedThin(const Alloc& alloc, Args&&... args) {
+  static_assert(std::is_empty<Alloc>::value && !std::is_final<Alloc>::value,
+                "thin pointers need a stateless, non-final allocator");
+  return ThinSharedPtr<T>(
+      AllocateShared<T>(alloc, std::forward<Args>(args)...));
+}
+
+template <typename T, typename... Args>
+ThinSharedPtr<T> MakeSharedThin(Args&&... args) {
+  return AllocateSharedThin<T>(MakeSharedAllocator<T>(),
+                               std::forward<Args>(args)...);
+}
+
+template <typename T>
+class ThinWeakPtr {
+ public:
+  ThinWeakPtr() noexcept = default;
+  ThinWeakPtr(const ThinSharedPtr<T>& other) noexcept;
+  ThinWeakPtr(const ThinWeakPtr& other) noexcept;
+  ThinWeakPtr(ThinWeakPtr&& other) noexcept;
+  ThinWeakPtr& operator=(const ThinWeakPtr& other) noexcept;
+  ThinWeakPtr& operator=(ThinWeakPtr&& other) noexcept;
+  ~ThinWeakPtr();
+  bool expired() const noexcept {
+    return control_ptr_ == nullptr || control_ptr_->use_count() == 0;
+  }
+  ThinSharedPtr<T> lock() const noexcept;
+
+ private:
+  void swap(ThinWeakPtr& other) noexcept {
+    std::swap(control_ptr_, other.control_ptr_);
+  }
+
+  SharedWeakCount* control_ptr_ = nullptr;
+};
+
+template <typename T>
+ThinWeakPtr<T>::ThinWeakPtr(const ThinSharedPtr<T>& other) noexcept
+    : control_ptr_(other.control_ptr_) {
+  if (control_ptr_ != nullptr) {
+    control_ptr_->add_weak();
+  }
+}
+
+template <typename T>
+ThinWeakPtr<T>::ThinWeakPtr(const ThinWeakPtr& other) noexcept
+    : control_ptr_(other.control_ptr_) {
+  if (control_ptr_ != nullptr) {
+    control_ptr_->add_weak();
+  }
+}
+
+template <typename T>
+ThinWeakPtr<T>::ThinWeakPtr(ThinWeakPtr&& other) noexcept
+    : control_ptr_(other.control_ptr_) {
+  other.control_ptr_ = nullptr;
+}
+
+template <typename T>
+ThinWeakPtr<T>& ThinWeakPtr<T>::operator=(const ThinWeakPtr& other) noexcept {
+  ThinWeakPtr(other).swap(*this);
+  return *this;
+}
+
+template <typename T>
+ThinWeakPtr<T>& ThinWeakPtr<T>::operator=(ThinWeakPtr&& other) noexcept {
+  ThinWeakPtr(std::move(other)).swap(*this);
+  return *this;
+}
+
+template <typename T>
+ThinWeakPtr<T>::~ThinWeakPtr() {
+  if (control_ptr_ != nullptr) {
+    control_ptr_->release_weak();
+  }
+}
+
+template <typename T>
+ThinSharedPtr<T> ThinWeakPtr<T>::lock() const noexcept {
+  ThinSharedPtr<T> ptr;
+  if (control_ptr_ != nullptr && control_ptr_->try_add_shared()) {
+    ptr.control_ptr_ = control_ptr_;
+  }
+  return ptr;
+}
+
+template <typename T, typename Count>
+class BasicWeakPtr {
+ public:
+  using element_type = typename std::remove_extent<T>::type;
+
+  BasicWeakPtr() noexcept : element_ptr_(nullptr), control_ptr_(nullptr) {}
+  BasicWeakPtr(const BasicWeakPtr& other) noexcept;
+  template <typename Y>
+  BasicWeakPtr(const BasicWeakPtr<Y, Count>& other) noexcept;
+  BasicWeakPtr(BasicWeakPtr&& other) noexcept;
+  template <typename Y>
+  BasicWeakPtr(BasicWeakPtr<Y, Count>&& other) noexcept;
+  template <typename Y>
+  BasicWeakPtr(const BasicWeakPtr<Y, Count>& other,
+               element_type* ptr) noexcept;
+  template <typename Y>
+  BasicWeakPtr(BasicWeakPtr<Y, Count>&& other, element_type* ptr) noexcept;
+  ~BasicWeakPtr();
+  template <typename Y>
+  BasicWeakPtr(const BasicSharedPtr<Y, Count>& other) noexcept;
+  BasicWeakPtr& operator=(const BasicWeakPtr& other) noexcept;
+  BasicWeakPtr& operator=(BasicWeakPtr&& other) noexcept;
+  template <typename Y>
+  BasicWeakPtr& operator=(const BasicWeakPtr<Y, Count>& other) noexcept;
+  template <typename Y>
+  BasicWeakPtr& operator=(BasicWeakPtr<Y, Count>&& other) noexcept;
+  bool expired() const noexcept {
+    return control_ptr_ == nullptr || control_ptr_->use_count() == 0;
+  }
+  BasicSharedPtr<T, Count> lock() const noexcept;
+
+ private:
+  template <typename Y, typename C>
+  friend class BasicSharedPtr;
+  template <typename Y, typename C>
+  friend class BasicWeakPtr;
+  void swap(BasicWeakPtr& other) noexcept;
+  element_type* element_ptr_ = nullptr;
+  Count* control_ptr_ = nullptr;
+};
+
+template <typename T, typename Count>
+BasicWeakPtr<T, Count>::BasicWeakPtr(const BasicWeakPtr& other) noexcept
+    : element_ptr_(other.element_ptr_), control_ptr_(other.control_ptr_) {
+  if (control_ptr_ != nullptr) {
+    control_ptr_->add_weak();
+  }
+}
+template <typename T, typename Count>
+template <typename Y>
+BasicWeakPtr<T, Count>::BasicWeakPtr(
+    const BasicWeakPtr<Y, Count>& other) noexcept
+    : element_ptr_(other.element_ptr_), control_ptr_(other.control_ptr_) {
+  if (control_ptr_ != nullptr) {
+    control_ptr_->add_weak();
+  }
+}
+
+template <typename T, typename Count>
+BasicWeakPtr<T, Count>::BasicWeakPtr(BasicWeakPtr&& other) noexcept
+    : element_ptr_(other.element_ptr_), control_ptr_(other.control_ptr_) {
+  other.element_ptr_ = nullptr;
+  other.control_ptr_ = nullptr;
+}
+
+template <typename T, typename Count>
+template <typename Y>
+BasicWeakPtr<T, Count>::BasicWeakPtr(BasicWeakPtr<Y, Count>&& other) noexcept
+    : element_ptr_(other.element_ptr_), control_ptr_(other.control_ptr_) {
+  other.element_ptr_ = nullptr;
+  other.control_ptr_ = nullptr;
+}
+
+template <typename T, typename Count>
+template <typename Y>
+BasicWeakPtr<T, Count>::BasicWeakPtr(const BasicWeakPtr<Y, Count>& other,
+                                     element_type* ptr) noexcept
+    : element_ptr_(ptr), control_ptr_(other.control_ptr_) {
+  if (control_ptr_ != nullptr) {
+    control_ptr_->add_weak();
+  }
+}
+
+template <typename T, typename Count>
+template <typename Y>
+BasicWeakPtr<T, Count>::BasicWeakPtr(BasicWeakPtr<Y, Count>&& other,
+                                     element_type* ptr) noexcept
+    : element_ptr_(ptr), control_ptr_(other.control_ptr_) {
+  other.element_ptr_ = nullptr;
+  other.control_ptr_ = nullptr;
+}
+
+template <typename T, typename Count>
+BasicWeakPtr<T, Count>::~BasicWeakPtr() {
+  if (control_ptr_ != nullptr) {
+    control_ptr_->release_weak();
+  }
+  control_ptr_ = nullptr;
+}
+
+template <typename T, typename Count>
+template <typename Y>
+BasicWeakPtr<T, Count>::BasicWeakPtr(
+    const BasicSharedPtr<Y, Count>& other) noexcept
+    : element_ptr_(other.element_ptr_), control_ptr_(other.control_ptr_) {
+  static_assert(!std::is_base_of<RefCountedBase,
+                                 typename std::remove_extent<Y>::type>::value,
+                "RefCountedBase objects are kept alive by weak references");
+  if (control_ptr_ != nullptr) {
+    if constexpr (std::is_same<Count, SharedWeakCount>::value) {
+      assert(!control_ptr_->intrusive() &&
+             "RefCountedBase objects are kept alive by weak references");
+    }
+    control_ptr_->add_weak();
+  }
+}
+
+template <typename T, typename Count>
+void BasicWeakPtr<T, Count>::swap(BasicWeakPtr<T, Count>& other) noexcept {
+  std::swap(element_ptr_, other.element_ptr_);
+  std::swap(control_ptr_, other.control_ptr_);
+}
+
+template <typename T, typename Count>
+BasicWeakPtr<T, Count>& BasicWeakPtr<T, Count>::operator=(
+    const BasicWeakPtr& other) noexcept {
+  BasicWeakPtr(other).swap(*this);
+  return *this;
+}
+
+template <typename T, typename Count>
+BasicWeakPtr<T, Count>& BasicWeakPtr<T, Count>::operator=(
+    BasicWeakPtr&& other) noexcept {
+  BasicWeakPtr(std::move(other)).swap(*this);
+  return *this;
+}
+
+template <typename T, typename Count>
+template <typename Y>
+BasicWeakPtr<T, Count>& BasicWeakPtr<T, Count>::operator=(
+    BasicWeakPtr<Y, Count>&& other) noexcept {
+  BasicWeakPtr(std::move(other)).swap(*this);
+  return *this;
+}
+
+template <typename T, typename Count>
+template <typename Y>
+BasicWeakPtr<T, Count>& BasicWeakPtr<T, Count>::operator=(
+    const BasicWeakPtr<Y, Count>& other) noexcept {
+  BasicWeakPtr(other).swap(*this);
+  return *this;
+}
+
+template <typename T, typename Count>
+BasicSharedPtr<T, Count> BasicWeakPtr<T, Count>::lock() const noexcept {
+  BasicSharedPtr<T, Count> smart_ptr;
+  if (control_ptr_ != nullptr && control_ptr_->try_add_shared()) {
+    smart_ptr.element_ptr_ = element_ptr_;
+    smart_ptr.control_ptr_ = control_ptr_;
+  }
+  return smart_ptr;
+}
+
+template <typename T>
+class EnableSharedFromThis {
+ public:
+  SharedPtr<T> SharedFromThis() { return weak_this_.lock(); }
+  SharedPtr<const T> SharedFromThis() const { return weak_this_.lock(); }
+  WeakPtr<T> WeakFromThis() noexcept { return weak_this_; }
+  WeakPtr<const T> WeakFromThis() const noexcept { return weak_this_; }
+
+ protected:
+  EnableSharedFromThis() noexcept = default;
+  EnableSharedFromThis(const EnableSharedFromThis&) noexcept {}
+  EnableSharedFromThis& operator=(const EnableSharedFromThis&) noexcept {
+    return *this;
+  }
+  ~EnableSharedFromThis() = default;
+
+ private:
+  template <typename U, typename C>
+  friend class BasicSharedPtr;
+
+  mutable WeakPtr<T> weak_this_;
+};
+
+template <typename T>
+class IntrusivePtr {
+ public:
+  IntrusivePtr() noexcept {}
+  IntrusivePtr(std::nullptr_t) noexcept {}
+  template <typename Y>
+  explicit IntrusivePtr(Y* ptr) noexcept;
+  IntrusivePtr(const IntrusivePtr& other) noexcept;
+  IntrusivePtr(IntrusivePtr&& other) noexcept;
+  template <typename Y>
+  IntrusivePtr(const IntrusivePtr<Y>& other) noexcept;
+  template <typename Y>
+  IntrusivePtr(IntrusivePtr<Y>&& other) noexcept;
+  IntrusivePtr& operator=(const IntrusivePtr& other) noexcept;
+  IntrusivePtr& operator=(IntrusivePtr&& other) noexcept;
+  template <typename Y>
+  IntrusivePtr& operator=(const IntrusivePtr<Y>& other) noexcept;
+  template <typename Y>
+  IntrusivePtr& operator=(IntrusivePtr<Y>&& other) noexcept;
+  ~IntrusivePtr();
+  size_t use_count() const noexcept;
+  T* get() const noexcept { return ptr_; }
+  typename std::add_lvalue_reference<T>::type operator*() const noexcept {
+    return *ptr_;
+  }
+  T* operator->() const noexcept { return ptr_; }
+  void reset() noexcept;
+
+ private:
+  template <typename U>
+  friend class IntrusivePtr;
+
+  void swap(IntrusivePtr& other) noexcept { std::swap(ptr_, other.ptr_); }
+  T* ptr_ = nullptr;
+};
+
+template <typename T>
+template <typename Y>
+IntrusivePtr<T>::IntrusivePtr(Y* ptr) noexcept : ptr_(ptr) {
+  static_assert(std::is_base_of<RefCountedBase, Y>::value,
+                "IntrusivePtr requires a type derived from RefCountedBase");
+  if (ptr_ != nullptr) {
+    RefCountedBase::get_count(ptr_)->add_shared();
+  }
+}
+
+template <typename T>
+IntrusivePtr<T>::IntrusivePtr(const IntrusivePtr& other) noexcept
+    : IntrusivePtr(other.ptr_) {}
+
+template <typename T>
+IntrusivePtr<T>::IntrusivePtr(IntrusivePtr&& other) noexcept
+    : ptr_(other.ptr_) {
+  other.ptr_ = nullptr;
+}
+
+template <typename T>
+template <typename Y>
+IntrusivePtr<T>::IntrusivePtr(const IntrusivePtr<Y>& other) noexcept
+    : IntrusivePtr(other.ptr_) {}
+
+template <typename T>
+template <typename Y>
+IntrusivePtr<T>::IntrusivePtr(IntrusivePtr<Y>&& other) noexcept
+    : ptr_(other.ptr_) {
+  other.ptr_ = nullptr;
+}
+
+template <typename T>
+IntrusivePtr<T>& IntrusivePtr<T>::operator=(
+    const IntrusivePtr& other) noexcept {
+  IntrusivePtr(other).swap(*this);
+  return *this;
+}
+
+template <typename T>
+IntrusivePtr<T>& IntrusivePtr<T>::operator=(IntrusivePtr&& other) noexcept {
+  IntrusivePtr(std::move(other)).swap(*this);
+  return *this;
+}
+
+template <typename T>
+template <typename Y>
+IntrusivePtr<T>& IntrusivePtr<T>::operator=(
+    const IntrusivePtr<Y>& other) noexcept {
+  IntrusivePtr(other).swap(*this);
+  return *this;
+}
+
+template <typename T>
+template <typename Y>
+IntrusivePtr<T>& IntrusivePtr<T>::operator=(IntrusivePtr<Y>&& other) noexcept {
+  IntrusivePtr(std::move(other)).swap(*this);
+  return *this;
+}
+
+template <typename T>
+IntrusivePtr<T>::~IntrusivePtr() {
+  if (ptr_ != nullptr) {
+    RefCountedBase::get_count(ptr_)->release_shared();
+  }
+}
+
+template <typename T>
+size_t IntrusivePtr<T>::use_count() const noexcept {
+  return ptr_ != nullptr ? RefCountedBase::get_count(ptr_)->use_count() : 0;
+}
+
+template <typename T>
+void IntrusivePtr<T>::reset() noexcept {
+  IntrusivePtr().swap(*this);
+}
+
+template <typename T, typename... Args>
+IntrusivePtr<T> MakeIntrusive(Args&&... args) {
+  return IntrusivePtr<T>(new T(std::forward<Args>(args)...));
+}
+
+#ifndef SMART_POINTERS_HAZARD_SCAN_THRESHOLD
+#define SMART_POINTERS_HAZARD_SCAN_THRESHOLD 64
+#endif
+
+class HazardDomain {
+ public:
+  struct alignas(64) Record {
+    std::atomic<const void*> hazard{nullptr};
+    std::atomic<bool> active{false};
+    Record* next = nullptr;
+  };
+
+  static Record* acquire_record();
+  static void release_record(Record* record) noexcept;
+  static void retire(const void* key, SharedWeakCount* control);
+  static void reclaim();
+
+ private:
+  struct Retired {
+    const void* key;
+    SharedWeakCount* control;
+  };
+  struct ThreadState {
+    std::vector<Retired>* retired;
+    bool closed;
+  };
+  struct ThreadExit {
+    ~ThreadExit();
+  };
+  struct Orphans {
+    ~Orphans();
+    std::mutex mutex;
+    std::vector<Retired> entries;
+  };
+
+  static std::vector<Retired>& open_retired();
+  static Orphans& orphans();
+  static void retire_orphan(const Retired& retired);
+  static void scan(std::vector<Retired>& entries);
+
+  static inline std::atomic<Record*> records_{nullptr};
+  static inline std::atomic<bool> exited_{false};
+  static inline thread_local ThreadState state_ = {};
+};
+
+inline HazardDomain::Record* HazardDomain::acquire_record() {
+  Record* head = records_.load(std::memory_order_acquire);
+  for (Record* record = head; record != nullptr; record = record->next) {
+    if (!record->active.load(std::memory_order_relaxed) &&
+        !record->active.exchange(true, std::memory_order_acquire)) {
+      return record;
+    }
+  }
+  Record* record = new Record;
+  record->active.store(true, std::memory_order_relaxed);
+  record->next = head;
+  while (!records_.compare_exchange_weak(record->next, record,
+                                         std::memory_order_release,
+                                         std::memory_order_acquire)) {
+  }
+  return record;
+}
+
+inline void HazardDomain::release_record(Record* record) noexcept {
+  record->hazard.store(nullptr, std::memory_order_release);
+  record->active.store(false, std::memory_order_release);
+}
+
+inline void HazardDomain::retire(const void* key, SharedWeakCount* control) {
+  ThreadState& state = state_;
+  if (state.closed) {
+    retire_orphan({key, control});
+    return;
+  }
+  std::vector<Retired>& entries =
+      state.retired != nullptr ? *state.retired : open_retired();
+  entries.push_back({key, control});
+  if (entries.size() >= SMART_POINTERS_HAZARD_SCAN_THRESHOLD) {
+    scan(entries);
+  }
+}
+
+inline void HazardDomain::reclaim() {
+  ThreadState& state = state_;
+  if (!state.closed) {
+    scan(state.retired != nullptr ? *state.retired : open_retired());
+  }
+}
+
+inline std::vector<HazardDomain::Retired>& HazardDomain::open_retired() {
+  orphans();
+  static thread_local ThreadExit thread_exit;
+  ThreadState& state = state_;
+  if (state.retired == nullptr) {
+    state.retired = new std::vector<Retired>;
+    state.retired->reserve(SMART_POINTERS_HAZARD_SCAN_THRESHOLD);
+  }
+  return *state.retired;
+}
+
+inline HazardDomain::Orphans& HazardDomain::orphans() {
+  static Orphans list;
+  return list;
+}
+
+inline void HazardDomain::retire_orphan(const Retired& retired) {
+  if (exited_.load(std::memory_order_acquire)) {
+    retired.control->release_shared();
+    return;
+  }
+  Orphans& list = orphans();
+  std::lock_guard<std::mutex> lock(list.mutex);
+  list.entries.push_back(retired);
+}
+
+inline void HazardDomain::scan(std::vector<Retired>& entries) {
+  {
+    Orphans& list = orphans();
+    std::unique_lock<std::mutex> lock(list.mutex, std::try_to_lock);
+    if (lock.owns_lock() && !list.entries.empty()) {
+      entries.insert(entries.end(), list.entries.begin(), list.entries.end());
+      list.entries.clear();
+    }
+  }
+  std::vector<const void*> hazards;
+  for (Record* record = records_.load(std::memory_order_acquire);
+       record != nullptr; record = record->next) {
+    const void* hazard = record->hazard.load(std::memory_order_seq_cst);
+    if (hazard != nullptr) {
+      hazards.push_back(hazard);
+    }
+  }
+  std::sort(hazards.begin(), hazards.end(), std::less<const void*>());
+  std::vector<Retired> pending;
+  pending.swap(entries);
+  for (const Retired& retired : pending) {
+    if (std::binary_search(hazards.begin(), hazards.end(), retired.key,
+                           std::less<const void*>())) {
+      entries.push_back(retired);
+    } else {
+      retired.control->release_shared();
+    }
+  }
+}
+
+inline HazardDomain::ThreadExit::~ThreadExit() {
+  ThreadState& state = state_;
+  state.closed = true;
+  std::vector<Retired>* retired = state.retired;
+  state.retired = nullptr;
+  scan(*retired);
+  for (const Retired& entry : *retired) {
+    retire_orphan(entry);
+  }
+  delete retired;
+}
+
+inline HazardDomain::Orphans::~Orphans() {
+  while (true) {
+    std::vector<Retired> pending;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      pending.swap(entries);
+    }
+    if (pending.empty()) {
+      break;
+    }
+    for (const Retired& retired : pending) {
+      retired.control->release_shared();
+    }
+  }
+  exited_.store(true, std::memory_order_release);
+}
+
+template <typename T>
+class HazardSlot {
+ public:
+  HazardSlot() noexcept = default;
+  explicit HazardSlot(SharedPtr<T> desired);
+  HazardSlot(const HazardSlot&) = delete;
+  HazardSlot& operator=(const HazardSlot&) = delete;
+  ~HazardSlot() { retire(std::move(owner_)); }
+  SharedPtr<T> load() const;
+  void store(SharedPtr<T> desired);
+
+ private:
+  friend class HazardPointer;
+
+  static void retire(SharedPtr<T>&& ptr);
+
+  std::atomic<T*> published_{nullptr};
+  mutable std::mutex mutex_;
+  SharedPtr<T> owner_;
+};
+
+class HazardPointer {
+ public:
+  HazardPointer() : record_(HazardDomain::acquire_record()) {}
+  HazardPointer(const HazardPointer&) = delete;
+  HazardPointer& operator=(const HazardPointer&) = delete;
+  ~HazardPointer() { HazardDomain::release_record(record_); }
+  template <typename T>
+  T* protect(const HazardSlot<T>& slot) noexcept;
+  void reset() noexcept {
+    record_->hazard.store(nullptr, std::memory_order_release);
+  }
+
+ private:
+  HazardDomain::Record* record_;
+};
+
+template <typename T>
+HazardSlot<T>::HazardSlot(SharedPtr<T> desired)
+    : published_(desired.get()), owner_(std::move(desired)) {}
+
+template <typename T>
+SharedPtr<T> HazardSlot<T>::load() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return owner_;
+}
+
+template <typename T>
+void HazardSlot<T>::store(SharedPtr<T> desired) {
+  SharedPtr<T> old;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    old = std::move(owner_);
+    owner_ = std::move(desired);
+    published_.store(owner_.get(), std::memory_order_seq_cst);
+  }
+  retire(std::move(old));
+}
+
+template <typename T>
+void HazardSlot<T>::retire(SharedPtr<T>&& ptr) {
+  if (ptr.control_ptr_ != nullptr) {
+    HazardDomain::retire(ptr.element_ptr_, ptr.control_ptr_);
+    ptr.element_ptr_ = nullptr;
+    ptr.control_ptr_ = nullptr;
+  }
+}
+
+template <typename T>
+T* HazardPointer::protect(const HazardSlot<T>& slot) noexcept {
+  T* ptr = slot.published_.load(std::memory_order_relaxed);
+  while (true) {
+    record_->hazard.store(ptr, std::memory_order_seq_cst);
+    T* current = slot.published_.load(std::memory_order_seq_cst);
+    if (current == ptr) {
+      return ptr;
+    }
+    ptr = current;
+  }
+}
+
+#ifndef SMART_POINTERS_EPOCH_RECLAIM_THRESHOLD
+#define SMART_POINTERS_EPOCH_RECLAIM_THRESHOLD 64
+#endif
+
+class EpochDomain {
+ public:
+  static void enter();
+  static void leave() noexcept;
+  static void retire(void* ptr, void (*destroy)(void*) noexcept) noexcept;
+  static void reclaim();
+  static void synchronize() noexcept;
+
+ private:
+  static constexpr uint64_t kInactive = ~uint64_t(0);
+
+  struct alignas(64) Record {
+    std::atomic<uint64_t> epoch{kInactive};
+    std::atomic<bool> active{false};
+    Record* next = nullptr;
+  };
+  struct Retired {
+    void* ptr;
+    void (*destroy)(void*) noexcept;
+    uint64_t epoch;
+  };
+  struct ThreadState {
+    Record* record;
+    size_t depth;
+    std::vector<Retired>* limbo;
+    bool closed;
+  };
+  struct ThreadExit {
+    ~ThreadExit();
+  };
+  struct Orphans {
+    ~Orphans();
+    std::mutex mutex;
+    std::vector<Retired> entries;
+  };
+
+  static std::vector<Retired>& open_limbo();
+  static Orphans& orphans();
+  static void retire_orphan(const Retired& retired) noexcept;
+  static Record* acquire_record();
+  static void release_record(ThreadState& state) noexcept;
+  static bool try_advance() noexcept;
+  static void free_expired(std::vector<Retired>& limbo);
+
+  static inline std::atomic<uint64_t> epoch_{0};
+  static inline std::atomic<Record*> records_{nullptr};
+  static inline std::atomic<bool> exited_{false};
+  static inline thread_local ThreadState state_ = {};
+};
+
+inline void EpochDomain::enter() {
+  ThreadState& state = state_;
+  if (state.depth++ == 0) {
+    if (state.record == nullptr) {
+      if (!state.closed) {
+        open_limbo();
+      }
+      state.record = acquire_record();
+    }
+    state.record->epoch.store(epoch_.load(std::memory_order_seq_cst),
+                              std::memory_order_seq_cst);
+  }
+}
+
+inline void EpochDomain::leave() noexcept {
+  ThreadState& state = state_;
+  assert(state.depth != 0 && "leave without enter");
+  if (--state.depth == 0) {
+    state.record->epoch.store(kInactive, std::memory_order_release);
+    if (state.closed) {
+      release_record(state);
+    }
+  }
+}
+
+inline void EpochDomain::retire(void* ptr,
+                                void (*destroy)(void*) noexcept) noexcept {
+  Retired retired = {ptr, destroy, epoch_.load(std::memory_order_seq_cst)};
+  ThreadState& state = state_;
+  if (state.closed) {
+    retire_orphan(retired);
+    return;
+  }
+  std::vector<Retired>& limbo =
+      state.limbo != nullptr ? *state.limbo : open_limbo();
+  limbo.push_back(retired);
+  if (limbo.size() >= SMART_POINTERS_EPOCH_RECLAIM_THRESHOLD) {
+    reclaim();
+  }
+}
+
+inline void EpochDomain::reclaim() {
+  ThreadState& state = state_;
+  if (state.closed) {
+    try_advance();
+    return;
+  }
+  std::vector<Retired>& limbo =
+      state.limbo != nullptr ? *state.limbo : open_limbo();
+  {
+    Orphans& list = orphans();
+    std::unique_lock<std::mutex> lock(list.mutex, std::try_to_lock);
+    if (lock.owns_lock() && !list.entries.empty()) {
+      limbo.insert(limbo.end(), list.entries.begin(), list.entries.end());
+      list.entries.clear();
+    }
+  }
+  try_advance();
+  free_expired(limbo);
+}
+
+// Waits until every reader that entered before the call has left.
+inline void EpochDomain::synchronize() noexcept {
+  assert(state_.depth == 0 && "synchronize inside an epoch guard");
+  uint64_t target = epoch_.load(std::memory_order_seq_cst) + 2;
+  while (epoch_.load(std::memory_order_seq_cst) < target) {
+    if (!try_advance()) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+inline std::vector<EpochDomain::Retired>& EpochDomain::open_limbo() {
+  orphans();
+  static thread_local ThreadExit thread_exit;
+  ThreadState& state = state_;
+  if (state.limbo == nullptr) {
+    state.limbo = new std::vector<Retired>;
+    state.limbo->reserve(SMART_POINTERS_EPOCH_RECLAIM_THRESHOLD);
+  }
+  return *state.limbo;
 }
 
-template <typename T, typename Deleter, typename Alloc>
-void SharedPtrPointer<T, Deleter, Alloc>::zero_shared_and_weak() noexcept {
-  using custom_alloc = typename std::allocator_traits<
-      Alloc>::template rebind_alloc<SharedPtrPointer>;
-  using custom_traits = std::allocator_traits<custom_alloc>;
-  using pointer_traits = std::pointer_traits<typename custom_traits::pointer>;
-  custom_alloc alloc(allocator_);
-  allocator_.~Alloc();
-  alloc.deallocate(pointer_traits::pointer_to(*this), 1);
+inline EpochDomain::Orphans& EpochDomain::orphans() {
+  static Orphans list;
+  return list;
 }
 
-template <typename T, typename Alloc>
-Alloc* SharedPtrEmplacer<T, Alloc>::Storage::get_alloc() noexcept {
-  pair* pair_ptr = reinterpret_cast<pair*>(pair_storage);
-  typename pair::first_type* first = std::addressof(pair_ptr->first);
-  Alloc* alloc = reinterpret_cast<Alloc*>(first);
-  return alloc;
+inline void EpochDomain::retire_orphan(const Retired& retired) noexcept {
+  if (exited_.load(std::memory_order_acquire)) {
+    retired.destroy(retired.ptr);
+    return;
+  }
+  Orphans& list = orphans();
+  std::lock_guard<std::mutex> lock(list.mutex);
+  list.entries.push_back(retired);
 }
 
-template <typename T, typename Alloc>
-T* SharedPtrEmplacer<T, Alloc>::Storage::get_elem() noexcept {
-  pair* pair_ptr = reinterpret_cast<pair*>(pair_storage);
-  typename pair::second_type* second = std::addressof(pair_ptr->second);
-  T* elem = reinterpret_cast<T*>(second);
-  return elem;
+inline EpochDomain::Record* EpochDomain::acquire_record() {
+  Record* head = records_.load(std::memory_order_acquire);
+  for (Record* record = head; record != nullptr; record = record->next) {
+    if (!record->active.load(std::memory_order_relaxed) &&
+        !record->active.exchange(true, std::memory_order_acquire)) {
+      return record;
+    }
+  }
+  Record* record = new Record;
+  record->active.store(true, std::memory_order_relaxed);
+  record->next = head;
+  while (!records_.compare_exchange_weak(record->next, record,
+                                         std::memory_order_release,
+                                         std::memory_order_acquire)) {
+  }
+  return record;
 }
 
-template <typename T, typename Alloc>
-SharedPtrEmplacer<T, Alloc>::Storage::Storage(Alloc&& alloc) {
-  ::new ((void*)get_alloc()) Alloc(std::move(alloc));
+inline void EpochDomain::release_record(ThreadState& state) noexcept {
+  state.record->epoch.store(kInactive, std::memory_order_release);
+  state.record->active.store(false, std::memory_order_release);
+  state.record = nullptr;
 }
 
-template <typename T, typename Alloc>
-SharedPtrEmplacer<T, Alloc>::Storage::~Storage() {
-  get_alloc()->~Alloc();
+inline bool EpochDomain::try_advance() noexcept {
+  uint64_t global = epoch_.load(std::memory_order_seq_cst);
+  for (Record* record = records_.load(std::memory_order_acquire);
+       record != nullptr; record = record->next) {
+    uint64_t local = record->epoch.load(std::memory_order_seq_cst);
+    if (local != kInactive && local != global) {
+      return false;
+    }
+  }
+  return epoch_.compare_exchange_strong(global, global + 1,
+                                        std::memory_order_acq_rel,
+                                        std::memory_order_relaxed);
 }
 
-template <typename T, typename Alloc>
-template <typename... Args>
-SharedPtrEmplacer<T, Alloc>::SharedPtrEmplacer(Alloc alloc, Args&&... args)
-    : storage_(std::move(alloc)) {
-  using type_alloc =
-      typename std::allocator_traits<Alloc>::template rebind_alloc<T>;
-  type_alloc temp(*get_alloc());
-  std::allocator_traits<type_alloc>::construct(temp, get_elem(),
-                                               std::forward<Args>(args)...);
+inline void EpochDomain::free_expired(std::vector<Retired>& limbo) {
+  uint64_t global = epoch_.load(std::memory_order_acquire);
+  std::vector<Retired> pending;
+  pending.swap(limbo);
+  for (const Retired& retired : pending) {
+    if (retired.epoch + 2 <= global) {
+      retired.destroy(retired.ptr);
+    } else {
+      limbo.push_back(retired);
+    }
+  }
 }
 
-template <typename T, typename Alloc>
-void SharedPtrEmplacer<T, Alloc>::zero_shared() noexcept {
-  using type_alloc =
-      typename std::allocator_traits<Alloc>::template rebind_alloc<T>;
-  type_alloc temp(*get_alloc());
-  std::allocator_traits<type_alloc>::destroy(temp, get_elem());
+inline EpochDomain::ThreadExit::~ThreadExit() {
+  ThreadState& state = state_;
+  state.closed = true;
+  if (state.record != nullptr && state.depth == 0) {
+    release_record(state);
+  }
+  std::vector<Retired>* limbo = state.limbo;
+  state.limbo = nullptr;
+  if (limbo != nullptr) {
+    try_advance();
+    free_expired(*limbo);
+    for (const Retired& retired : *limbo) {
+      retire_orphan(retired);
+    }
+    delete limbo;
+  }
 }
 
-template <typename T, typename Alloc>
-void SharedPtrEmplacer<T, Alloc>::zero_shared_and_weak() noexcept {
-  using control_block_alloc = typename std::allocator_traits<
-      Alloc>::template rebind_alloc<SharedPtrEmplacer>;
-  using control_block_pointer =
-      typename std::allocator_traits<control_block_alloc>::pointer;
-  control_block_alloc temp(*get_alloc());
-  storage_.~Storage();
-  std::allocator_traits<control_block_alloc>::deallocate(
-      temp, std::pointer_traits<control_block_pointer>::pointer_to(*this), 1);
+inline EpochDomain::Orphans::~Orphans() {
+  while (true) {
+    std::vector<Retired> pending;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      pending.swap(entries);
+    }
+    if (pending.empty()) {
+      break;
+    }
+    for (const Retired& retired : pending) {
+      retired.destroy(retired.ptr);
+    }
+  }
+  exited_.store(true, std::memory_order_release);
 }
 
-template <typename T>
-class SharedPtr {
+class EpochGuard {
  public:
-  SharedPtr() noexcept {}
-  SharedPtr(std::nullptr_t) {}
-  template <typename Y>
-  explicit SharedPtr(Y* ptr);
-  SharedPtr(const SharedPtr& other) noexcept;
-  SharedPtr(SharedPtr&& other) noexcept;
-  template <typename Y>
-  SharedPtr(const SharedPtr<Y>& other) noexcept;
-  template <typename Y>
-  SharedPtr(SharedPtr<Y>&& other) noexcept;
-  template <typename Y, typename Deleter>
-  SharedPtr(Y* ptr, Deleter del);
-  template <typename Y, typename Deleter, typename Alloc>
-  SharedPtr(Y* ptr, Deleter del, Alloc alloc);
-  SharedPtr& operator=(const SharedPtr& other) noexcept;
-  SharedPtr& operator=(SharedPtr&& other) noexcept;
-  template <typename Y>
-  SharedPtr<T>& operator=(const SharedPtr<Y>& other) noexcept;
-  template <typename Y>
-  SharedPtr<T>& operator=(SharedPtr<Y>&& other) noexcept;
-  ~SharedPtr();
-  size_t use_count() const noexcept;
-  T* get() const noexcept;
-  typename std::add_lvalue_reference<T>::type operator*() const noexcept;
-  T* operator->() const noexcept;
-  void reset() noexcept;
+  EpochGuard() { EpochDomain::enter(); }
+  EpochGuard(const EpochGuard&) = delete;
+  EpochGuard& operator=(const EpochGuard&) = delete;
+  ~EpochGuard() { EpochDomain::leave(); }
+};
+
+template <typename T>
+struct EpochDeleter {
+  static_assert(!std::is_array<T>::value, "arrays are not supported");
+
+  EpochDeleter() noexcept = default;
+  template <typename U,
+            typename = typename std::enable_if<
+                std::is_convertible<U*, T*>::value>::type>
+  EpochDeleter(const EpochDeleter<U>&) noexcept {}
+
+  // Readers may still see the object, so a failure to queue it cannot fall
+  // back to deleting inline: running out of memory here terminates.
+  void operator()(T* ptr) const noexcept {
+    EpochDomain::retire(const_cast<void*>(static_cast<const void*>(ptr)),
+                        &destroy);
+  }
 
  private:
-  template <typename Y, typename ControlBlock>
-  static SharedPtr create_with_control_block(Y* ptr,
-                                             ControlBlock* block) noexcept;
-  template <typename U>
-  struct SharedPtrDefaultAllocator {
-    using type = std::allocator<U>;
-  };
+  static void destroy(void* ptr) noexcept { delete static_cast<T*>(ptr); }
+};
 
-  template <typename, typename U>
-  struct SharedPtrDefaultDeleter : std::default_delete<U> {};
+// Readers pin the published slot with an epoch guard and take one strong
+// reference on its control block; writers are serialised, fill the spare
+// slot, flip to it and wait for a grace period before the old slot and its
+// reference may be reused. load() never blocks; store() must not be called
+// from inside an EpochGuard.
+template <typename T>
+class AtomicSharedPtr {
+ public:
+  AtomicSharedPtr() noexcept = default;
+  AtomicSharedPtr(SharedPtr<T> desired) noexcept;
+  AtomicSharedPtr(const AtomicSharedPtr&) = delete;
+  AtomicSharedPtr& operator=(const AtomicSharedPtr&) = delete;
+  AtomicSharedPtr& operator=(SharedPtr<T> desired);
+  ~AtomicSharedPtr();
+  operator SharedPtr<T>() const { return load(); }
+  bool is_lock_free() const noexcept { return false; }
+  SharedPtr<T> load() const;
+  void store(SharedPtr<T> desired);
+  SharedPtr<T> exchange(SharedPtr<T> desired);
+  bool compare_exchange_weak(SharedPtr<T>& expected, SharedPtr<T> desired);
+  bool compare_exchange_strong(SharedPtr<T>& expected, SharedPtr<T> desired);
 
-  template <typename U>
-  friend class WeakPtr;
+ private:
+  using element_type = typename SharedPtr<T>::element_type;
 
-  template <typename Y, typename Alloc, typename... Args>
-  friend SharedPtr<Y> AllocateShared(const Alloc& alloc, Args&&... args);
+  struct Slot {
+    element_type* element;
+    SharedWeakCount* control;
+  };
 
-  template <typename U>
-  friend class SharedPtr;
+  static SharedPtr<T> adopt(const Slot& slot) noexcept;
+  SharedPtr<T> publish(SharedPtr<T>&& desired);
 
-  void swap(SharedPtr& other) noexcept;
-  T* element_ptr_ = nullptr;
-  SharedWeakCount* control_ptr_ = nullptr;
+  Slot slots_[2] = {};
+  std::atomic<const Slot*> current_{&slots_[0]};
+  std::mutex mutex_;
 };
 
 template <typename T>
-template <typename Y>
-SharedPtr<T>::SharedPtr(Y* ptr) : element_ptr_(ptr) {
-  using alloc_t = typename SharedPtrDefaultAllocator<Y>::type;
-  using control_block =
-      SharedPtrPointer<Y*, SharedPtrDefaultDeleter<T, Y>, alloc_t>;
-  control_ptr_ =
-      new control_block(ptr, SharedPtrDefaultDeleter<T, Y>(), alloc_t());
-  control_ptr_->add_shared();
+AtomicSharedPtr<T>::AtomicSharedPtr(SharedPtr<T> desired) noexcept {
+  slots_[0] = {desired.element_ptr_, desired.control_ptr_};
+  desired.element_ptr_ = nullptr;
+  desired.control_ptr_ = nullptr;
 }
 
 template <typename T>
-template <typename Y, typename Deleter>
-SharedPtr<T>::SharedPtr(Y* ptr, Deleter del) : element_ptr_(ptr) {
-  try {
-    using alloc_t = typename SharedPtrDefaultAllocator<Y>::type;
-    using control_block = SharedPtrPointer<Y*, Deleter, alloc_t>;
-    control_ptr_ = new control_block(ptr, std::move(del), alloc_t());
-    control_ptr_->add_shared();
-  } catch (...) {
-    del(ptr);
-    throw;
-  }
+AtomicSharedPtr<T>& AtomicSharedPtr<T>::operator=(SharedPtr<T> desired) {
+  store(std::move(desired));
+  return *this;
 }
 
 template <typename T>
-template <typename Y, typename Deleter, typename Alloc>
-SharedPtr<T>::SharedPtr(Y* ptr, Deleter del, Alloc alloc) : element_ptr_(ptr) {
-  using control_block = SharedPtrPointer<Y*, Deleter, Alloc>;
-  using rebinded_alloc = typename std::allocator_traits<
-      Alloc>::template rebind_alloc<control_block>;
-  using destructor = AllocatorDestructor<rebinded_alloc>;
-  using rebinded_traits = std::allocator_traits<rebinded_alloc>;
-  rebinded_alloc rebinded(alloc);
-  control_ptr_ = rebinded_traits::allocate(rebinded, 1);
-  try {
-    rebinded_traits::construct(rebinded,
-                               reinterpret_cast<control_block*>(control_ptr_),
-                               control_block(ptr, std::move(del), alloc));
-    control_ptr_->add_shared();
-  } catch (...) {
-    rebinded_traits::deallocate(
-        rebinded, reinterpret_cast<control_block*>(control_ptr_), 1);
-    del(ptr);
-    throw;
-  }
+AtomicSharedPtr<T>::~AtomicSharedPtr() {
+  adopt(*current_.load(std::memory_order_acquire));
 }
 
 template <typename T>
-SharedPtr<T>::SharedPtr(const SharedPtr& other) noexcept
-    : element_ptr_(other.element_ptr_), control_ptr_(other.control_ptr_) {
-  if (control_ptr_ != nullptr) {
-    control_ptr_->add_shared();
-  }
+SharedPtr<T> AtomicSharedPtr<T>::adopt(const Slot& slot) noexcept {
+  SharedPtr<T> ptr;
+  ptr.element_ptr_ = slot.element;
+  ptr.control_ptr_ = slot.control;
+  return ptr;
 }
 
 template <typename T>
-template <typename Y>
-SharedPtr<T>::SharedPtr(const SharedPtr<Y>& other) noexcept
-    : element_ptr_(other.element_ptr_), control_ptr_(other.control_ptr_) {
-  if (control_ptr_ != nullptr) {
-    control_ptr_->add_shared();
+SharedPtr<T> AtomicSharedPtr<T>::load() const {
+  EpochGuard guard;
+  const Slot* slot = current_.load(std::memory_order_seq_cst);
+  if (slot->control != nullptr) {
+    slot->control->add_shared();
   }
+  return adopt(*slot);
 }
 
 template <typename T>
-SharedPtr<T>::SharedPtr(SharedPtr&& other) noexcept
-    : element_ptr_(other.element_ptr_), control_ptr_(other.control_ptr_) {
-  other.element_ptr_ = nullptr;
-  other.control_ptr_ = nullptr;
+SharedPtr<T> AtomicSharedPtr<T>::publish(SharedPtr<T>&& desired) {
+  const Slot* current = current_.load(std::memory_order_relaxed);
+  Slot* next = current == &slots_[0] ? &slots_[1] : &slots_[0];
+  *next = {desired.element_ptr_, desired.control_ptr_};
+  desired.element_ptr_ = nullptr;
+  desired.control_ptr_ = nullptr;
+  current_.store(next, std::memory_order_seq_cst);
+  EpochDomain::synchronize();
+  return adopt(*current);
 }
 
 template <typename T>
-template <typename Y>
-SharedPtr<T>::SharedPtr(SharedPtr<Y>&& other) noexcept
-    : element_ptr_(other.element_ptr_), control_ptr_(other.control_ptr_) {
-  other.element_ptr_ = nullptr;
-  other.control_ptr_ = nullptr;
+void AtomicSharedPtr<T>::store(SharedPtr<T> desired) {
+  exchange(std::move(desired));
 }
 
 template <typename T>
-SharedPtr<T>::~SharedPtr() {
-  if (control_ptr_ != nullptr) {
-    control_ptr_->decrement_shared();
-    control_ptr_->release_shared();
-    if (control_ptr_->use_count() == 0) {
-      control_ptr_->release_weak();
-    }
-  }
-  control_ptr_ = nullptr;
+SharedPtr<T> AtomicSharedPtr<T>::exchange(SharedPtr<T> desired) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return publish(std::move(desired));
 }
 
 template <typename T>
-void SharedPtr<T>::swap(SharedPtr<T>& other) noexcept {
-  std::swap(element_ptr_, other.element_ptr_);
-  std::swap(control_ptr_, other.control_ptr_);
+bool AtomicSharedPtr<T>::compare_exchange_weak(SharedPtr<T>& expected,
+                                               SharedPtr<T> desired) {
+  return compare_exchange_strong(expected, std::move(desired));
 }
 
 template <typename T>
-SharedPtr<T>& SharedPtr<T>::operator=(const SharedPtr& other) noexcept {
-  SharedPtr(other).swap(*this);
-  return *this;
+bool AtomicSharedPtr<T>::compare_exchange_strong(SharedPtr<T>& expected,
+                                                 SharedPtr<T> desired) {
+  SharedPtr<T> old;
+  std::lock_guard<std::mutex> lock(mutex_);
+  const Slot* current = current_.load(std::memory_order_relaxed);
+  if (current->element != expected.element_ptr_ ||
+      current->control != expected.control_ptr_) {
+    if (current->control != nullptr) {
+      current->control->add_shared();
+    }
+    old = std::move(expected);
+    expected = adopt(*current);
+    return false;
+  }
+  old = publish(std::move(desired));
+  return true;
 }
 
 template <typename T>
-template <typename Y>
-SharedPtr<T>& SharedPtr<T>::operator=(const SharedPtr<Y>& other) noexcept {
-  SharedPtr(other).swap(*this);
-  return *this;
-}
+class RcuCell {
+ public:
+  class Snapshot {
+   public:
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+    const T* get() const noexcept { return ptr_; }
+    const T& operator*() const noexcept { return *ptr_; }
+    const T* operator->() const noexcept { return ptr_; }
+    explicit operator bool() const noexcept { return ptr_ != nullptr; }
+
+   private:
+    friend class RcuCell;
+
+    explicit Snapshot(const std::atomic<const T*>& published)
+        : ptr_(published.load(std::memory_order_seq_cst)) {}
+
+    EpochGuard guard_;
+    const T* ptr_;
+  };
 
-template <typename T>
-SharedPtr<T>& SharedPtr<T>::operator=(SharedPtr<T>&& other) noexcept {
-  SharedPtr(std::move(other)).swap(*this);
-  return *this;
-}
+  RcuCell() noexcept = default;
+  explicit RcuCell(SharedPtr<const T> initial);
+  RcuCell(const RcuCell&) = delete;
+  RcuCell& operator=(const RcuCell&) = delete;
+  ~RcuCell() { retire(std::move(current_)); }
+  Snapshot read() const { return Snapshot(published_); }
+  SharedPtr<const T> load() const;
+  void store(SharedPtr<const T> desired);
+  template <typename Fn>
+  void update(Fn&& fn);
 
-template <typename T>
-template <typename Y>
-SharedPtr<T>& SharedPtr<T>::operator=(SharedPtr<Y>&& other) noexcept {
-  SharedPtr(std::move(other)).swap(*this);
-  return *this;
-}
+ private:
+  static void retire(SharedPtr<const T>&& ptr);
+  static void release(void* control) noexcept {
+    static_cast<SharedWeakCount*>(control)->release_shared();
+  }
 
-template <typename T>
-void SharedPtr<T>::reset() noexcept {
-  SharedPtr().swap(*this);
-}
+  std::atomic<const T*> published_{nullptr};
+  mutable std::mutex mutex_;
+  SharedPtr<const T> current_;
+};
 
 template <typename T>
-T* SharedPtr<T>::get() const noexcept {
-  return element_ptr_;
-}
+RcuCell<T>::RcuCell(SharedPtr<const T> initial)
+    : published_(initial.get()), current_(std::move(initial)) {}
 
 template <typename T>
-typename std::add_lvalue_reference<T>::type SharedPtr<T>::operator*()
-    const noexcept {
-  return *element_ptr_;
+SharedPtr<const T> RcuCell<T>::load() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return current_;
 }
 
 template <typename T>
-T* SharedPtr<T>::operator->() const noexcept {
-  return element_ptr_;
+void RcuCell<T>::store(SharedPtr<const T> desired) {
+  SharedPtr<const T> old;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    old = std::move(current_);
+    current_ = std::move(desired);
+    published_.store(current_.get(), std::memory_order_seq_cst);
+  }
+  retire(std::move(old));
 }
 
 template <typename T>
-size_t SharedPtr<T>::use_count() const noexcept {
-  return control_ptr_ != nullptr ? control_ptr_->use_count() : 0;
+template <typename Fn>
+void RcuCell<T>::update(Fn&& fn) {
+  SharedPtr<const T> old;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    assert(current_.get() != nullptr && "update of an empty cell");
+    T copy(*current_);
+    std::forward<Fn>(fn)(copy);
+    SharedPtr<const T> next = MakeShared<T>(std::move(copy));
+    old = std::move(current_);
+    current_ = std::move(next);
+    published_.store(current_.get(), std::memory_order_seq_cst);
+  }
+  retire(std::move(old));
 }
 
+// Publication and the snapshot load are seq_cst so that they order against
+// the epoch store on entry and the epoch load in retire: a reader either
+// sees the new value or holds an epoch that keeps the old one alive.
 template <typename T>
-template <typename Y, typename ControlBlock>
-SharedPtr<T> SharedPtr<T>::create_with_control_block(
-    Y* ptr, ControlBlock* block) noexcept {
-  SharedPtr<T> smart_ptr;
-  smart_ptr.element_ptr_ = ptr;
-  smart_ptr.control_ptr_ = block;
-  smart_ptr.control_ptr_->add_shared();
-  return smart_ptr;
-}
-
-template <typename T, typename Alloc, typename... Args>
-SharedPtr<T> AllocateShared(const Alloc& alloc, Args&&... args) {
-  using control_block = SharedPtrEmplacer<T, Alloc>;
-  using cntrl_allocator = typename std::allocator_traits<
-      Alloc>::template rebind_alloc<control_block>;
-  using cntrl_traits = std::allocator_traits<cntrl_allocator>;
-  cntrl_allocator control_alloc(alloc);
-  control_block* block = reinterpret_cast<control_block*>(
-      cntrl_traits::allocate(control_alloc, 1));
-  ::new (reinterpret_cast<control_block*>(block))
-      control_block(alloc, std::forward<Args>(args)...);
-  return SharedPtr<T>::create_with_control_block((*block).get_elem(),
-                                                 std::addressof(*block));
+void RcuCell<T>::retire(SharedPtr<const T>&& ptr) {
+  if (ptr.control_ptr_ != nullptr) {
+    EpochDomain::retire(ptr.control_ptr_, &release);
+    ptr.element_ptr_ = nullptr;
+    ptr.control_ptr_ = nullptr;
+    // Updates are rare, so waiting for the retire threshold would keep old
+    // snapshots alive indefinitely; two advances free any nobody reads.
+    EpochDomain::reclaim();
+    EpochDomain::reclaim();
+  }
 }
 
-template <typename T, typename... Args>
-SharedPtr<T> MakeShared(Args&&... args) {
-  return AllocateShared<T>(std::allocator<T>(), std::forward<Args>(args)...);
-}
+#ifndef SMART_POINTERS_ASYNC_DESTROY_THREADS
+#define SMART_POINTERS_ASYNC_DESTROY_THREADS 2
+#endif
+
+#ifndef SMART_POINTERS_ASYNC_DESTROY_QUEUE_DEPTH
+#define SMART_POINTERS_ASYNC_DESTROY_QUEUE_DEPTH 1024
+#endif
+
+struct AsyncDestroyStats {
+  uint64_t enqueued;
+  uint64_t completed;
+  uint64_t inline_destroys;
+  uint64_t total_latency_ns;
+  uint64_t max_latency_ns;
+  size_t depth;
+};
 
-template <typename T>
-class WeakPtr {
+class AsyncDestroyPool {
  public:
-  WeakPtr() noexcept : element_ptr_(nullptr), control_ptr_(nullptr) {}
-  WeakPtr(const WeakPtr& other) noexcept;
-  template <typename Y>
-  WeakPtr(const WeakPtr<Y>& other) noexcept;
-  WeakPtr(WeakPtr&& other) noexcept;
-  template <typename Y>
-  WeakPtr(WeakPtr<Y>&& other) noexcept;
-  ~WeakPtr();
-  template <typename Y>
-  WeakPtr(const SharedPtr<Y>& other) noexcept;
-  WeakPtr& operator=(const WeakPtr& other) noexcept;
-  WeakPtr& operator=(WeakPtr&& other) noexcept;
-  template <typename Y>
-  WeakPtr& operator=(const WeakPtr<Y>& other) noexcept;
-  template <typename Y>
-  WeakPtr& operator=(WeakPtr<Y>&& other) noexcept;
-  bool expired() const noexcept {
-    return control_ptr_ == nullptr || control_ptr_->use_count() == 0;
-  }
-  SharedPtr<T> lock() const noexcept;
+  static constexpr size_t kThreads = SMART_POINTERS_ASYNC_DESTROY_THREADS;
+  static constexpr size_t kQueueDepth =
+      SMART_POINTERS_ASYNC_DESTROY_QUEUE_DEPTH;
+
+  static void submit(void* ptr, void (*destroy)(void*) noexcept) noexcept;
+  static void shutdown() noexcept;
+  static AsyncDestroyStats stats() noexcept;
 
  private:
-  template <typename Y>
-  friend class SharedPtr;
-  void swap(WeakPtr& other) noexcept;
-  T* element_ptr_ = nullptr;
-  SharedWeakCount* control_ptr_ = nullptr;
+  using clock = std::chrono::steady_clock;
+
+  struct Task {
+    void* ptr;
+    void (*destroy)(void*) noexcept;
+    clock::time_point enqueued;
+  };
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+    std::thread thread;
+  };
+
+  AsyncDestroyPool();
+  ~AsyncDestroyPool();
+  static AsyncDestroyPool& instance();
+  bool try_push(void* ptr, void (*destroy)(void*) noexcept) noexcept;
+  bool try_pop(size_t self, Task& task);
+  void run(size_t self);
+  void finish(const Task& task) noexcept;
+  void release_depth() noexcept;
+  void stop() noexcept;
+  void join() noexcept;
+
+  static inline std::atomic<bool> exited_{false};
+  Worker workers_[kThreads];
+  std::mutex wait_mutex_;
+  std::condition_variable wake_;
+  std::atomic<bool> stopping_{false};
+  std::atomic<size_t> depth_{0};
+  std::atomic<size_t> queued_{0};
+  std::atomic<size_t> next_{0};
+  std::atomic<uint64_t> enqueued_{0};
+  std::atomic<uint64_t> completed_{0};
+  std::atomic<uint64_t> inline_destroys_{0};
+  std::atomic<uint64_t> total_latency_ns_{0};
+  std::atomic<uint64_t> max_latency_ns_{0};
 };
 
-template <typename T>
-WeakPtr<T>::WeakPtr(const WeakPtr& other) noexcept
-    : element_ptr_(other.element_ptr_), control_ptr_(other.control_ptr_) {
-  if (control_ptr_ != nullptr) {
-    control_ptr_->add_weak();
+inline AsyncDestroyPool::AsyncDestroyPool() {
+  for (size_t i = 0; i < kThreads; ++i) {
+    workers_[i].thread = std::thread(&AsyncDestroyPool::run, this, i);
   }
 }
-template <typename T>
-template <typename Y>
-WeakPtr<T>::WeakPtr(const WeakPtr<Y>& other) noexcept
-    : element_ptr_(other.element_ptr_), control_ptr_(other.control_ptr_) {
-  if (control_ptr_ != nullptr) {
-    control_ptr_->add_weak();
+
+// Deleters that run during static destruction, after the pool is gone,
+// destroy inline.
+inline AsyncDestroyPool::~AsyncDestroyPool() {
+  stop();
+  join();
+  exited_.store(true, std::memory_order_release);
+}
+
+inline AsyncDestroyPool& AsyncDestroyPool::instance() {
+  static AsyncDestroyPool pool;
+  return pool;
+}
+
+inline void AsyncDestroyPool::submit(void* ptr,
+                                     void (*destroy)(void*) noexcept) noexcept {
+  AsyncDestroyPool* pool = nullptr;
+  if (exited_.load(std::memory_order_acquire)) {
+    destroy(ptr);
+    return;
+  }
+  try {
+    pool = &instance();
+  } catch (...) {
   }
+  if (pool != nullptr) {
+    if (pool->try_push(ptr, destroy)) {
+      return;
+    }
+    pool->inline_destroys_.fetch_add(1, std::memory_order_relaxed);
+  }
+  destroy(ptr);
 }
 
-template <typename T>
-WeakPtr<T>::WeakPtr(WeakPtr&& other) noexcept
-    : element_ptr_(other.element_ptr_), control_ptr_(other.control_ptr_) {
-  other.element_ptr_ = nullptr;
-  other.control_ptr_ = nullptr;
+inline bool AsyncDestroyPool::try_push(
+    void* ptr, void (*destroy)(void*) noexcept) noexcept {
+  if (depth_.fetch_add(1, std::memory_order_seq_cst) >= kQueueDepth ||
+      stopping_.load(std::memory_order_seq_cst)) {
+    release_depth();
+    return false;
+  }
+  Worker& worker =
+      workers_[next_.fetch_add(1, std::memory_order_relaxed) % kThreads];
+  try {
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    worker.tasks.push_back({ptr, destroy, clock::now()});
+  } catch (...) {
+    release_depth();
+    return false;
+  }
+  queued_.fetch_add(1, std::memory_order_release);
+  enqueued_.fetch_add(1, std::memory_order_relaxed);
+  { std::lock_guard<std::mutex> lock(wait_mutex_); }
+  wake_.notify_one();
+  return true;
 }
 
-template <typename T>
-template <typename Y>
-WeakPtr<T>::WeakPtr(WeakPtr<Y>&& other) noexcept
-    : element_ptr_(other.element_ptr_), control_ptr_(other.control_ptr_) {
-  other.element_ptr_ = nullptr;
-  other.control_ptr_ = nullptr;
+inline void AsyncDestroyPool::shutdown() noexcept {
+  if (!exited_.load(std::memory_order_acquire)) {
+    instance().stop();
+  }
 }
 
-template <typename T>
-WeakPtr<T>::~WeakPtr() {
-  if (control_ptr_ != nullptr) {
-    control_ptr_->decrement_weak();
-    if (control_ptr_->use_count() == 0) {
-      control_ptr_->release_weak();
-    }
+inline AsyncDestroyStats AsyncDestroyPool::stats() noexcept {
+  if (exited_.load(std::memory_order_acquire)) {
+    return {};
   }
-  control_ptr_ = nullptr;
+  AsyncDestroyPool& pool = instance();
+  return {pool.enqueued_.load(std::memory_order_relaxed),
+          pool.completed_.load(std::memory_order_relaxed),
+          pool.inline_destroys_.load(std::memory_order_relaxed),
+          pool.total_latency_ns_.load(std::memory_order_relaxed),
+          pool.max_latency_ns_.load(std::memory_order_relaxed),
+          pool.depth_.load(std::memory_order_relaxed)};
 }
 
-template <typename T>
-template <typename Y>
-WeakPtr<T>::WeakPtr(const SharedPtr<Y>& other) noexcept
-    : element_ptr_(other.element_ptr_), control_ptr_(other.control_ptr_) {
-  if (control_ptr_ != nullptr) {
-    control_ptr_->add_weak();
+inline bool AsyncDestroyPool::try_pop(size_t self, Task& task) {
+  for (size_t i = 0; i < kThreads; ++i) {
+    Worker& worker = workers_[(self + i) % kThreads];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (!worker.tasks.empty()) {
+      if (i == 0) {
+        task = worker.tasks.front();
+        worker.tasks.pop_front();
+      } else {
+        task = worker.tasks.back();
+        worker.tasks.pop_back();
+      }
+      queued_.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+    }
   }
+  return false;
 }
 
-template <typename T>
-void WeakPtr<T>::swap(WeakPtr<T>& other) noexcept {
-  std::swap(element_ptr_, other.element_ptr_);
-  std::swap(control_ptr_, other.control_ptr_);
+inline void AsyncDestroyPool::run(size_t self) {
+  while (true) {
+    Task task;
+    if (try_pop(self, task)) {
+      finish(task);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(wait_mutex_);
+    if (stopping_.load(std::memory_order_seq_cst) &&
+        depth_.load(std::memory_order_seq_cst) == 0) {
+      return;
+    }
+    // Once stopping, tasks still running on other workers keep depth_ up;
+    // release_depth() wakes us when the last of them completes.
+    wake_.wait(lock, [this] {
+      return queued_.load(std::memory_order_acquire) != 0 ||
+             (stopping_.load(std::memory_order_seq_cst) &&
+              depth_.load(std::memory_order_seq_cst) == 0);
+    });
+  }
 }
 
-template <typename T>
-WeakPtr<T>& WeakPtr<T>::operator=(const WeakPtr<T>& other) noexcept {
-  WeakPtr(other).swap(*this);
-  return *this;
+inline void AsyncDestroyPool::finish(const Task& task) noexcept {
+  uint64_t latency = static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() -
+                                                           task.enqueued)
+          .count());
+  total_latency_ns_.fetch_add(latency, std::memory_order_relaxed);
+  uint64_t max = max_latency_ns_.load(std::memory_order_relaxed);
+  while (latency > max && !max_latency_ns_.compare_exchange_weak(
+                              max, latency, std::memory_order_relaxed)) {
+  }
+  task.destroy(task.ptr);
+  completed_.fetch_add(1, std::memory_order_relaxed);
+  release_depth();
 }
 
-template <typename T>
-WeakPtr<T>& WeakPtr<T>::operator=(WeakPtr<T>&& other) noexcept {
-  WeakPtr(std::move(other)).swap(*this);
-  return *this;
+inline void AsyncDestroyPool::release_depth() noexcept {
+  if (depth_.fetch_sub(1, std::memory_order_seq_cst) == 1 &&
+      stopping_.load(std::memory_order_seq_cst)) {
+    { std::lock_guard<std::mutex> lock(wait_mutex_); }
+    wake_.notify_all();
+  }
 }
 
-template <typename T>
-template <typename Y>
-WeakPtr<T>& WeakPtr<T>::operator=(WeakPtr<Y>&& other) noexcept {
-  WeakPtr(std::move(other)).swap(*this);
+inline void AsyncDestroyPool::stop() noexcept {
+  {
+    std::lock_guard<std::mutex> lock(wait_mutex_);
+    if (stopping_.exchange(true, std::memory_order_seq_cst)) {
+      return;
+    }
+  }
+  wake_.notify_all();
+  // A worker stopping the pool from a destructor it is running cannot wait:
+  // the others drain until its own task completes. The pool's destructor
+  // joins them instead.
+  for (Worker& worker : workers_) {
+    if (worker.thread.get_id() == std::this_thread::get_id()) {
+      return;
+    }
+  }
+  join();
 }
 
-template <typename T>
-template <typename Y>
-WeakPtr<T>& WeakPtr<T>::operator=(const WeakPtr<Y>& other) noexcept {
-  WeakPtr(other).swap(*this);
-  return *this;
+inline void AsyncDestroyPool::join() noexcept {
+  for (Worker& worker : workers_) {
+    if (worker.thread.get_id() == std::this_thread::get_id()) {
+      worker.thread.detach();
+    } else if (worker.thread.joinable()) {
+      worker.thread.join();
+    }
+  }
 }
 
 template <typename T>
-SharedPtr<T> WeakPtr<T>::lock() const noexcept {
-  SharedPtr<T> smart_ptr;
-  smart_ptr.control_ptr_ = (control_ptr_ != nullptr) ? control_ptr_ : nullptr;
-  if (smart_ptr.control_ptr_ != nullptr) {
-    smart_ptr.element_ptr_ = element_ptr_;
+struct AsyncDeleter {
+  static_assert(!std::is_array<T>::value, "arrays are not supported");
+
+  AsyncDeleter() noexcept = default;
+  template <typename U,
+            typename = typename std::enable_if<
+                std::is_convertible<U*, T*>::value>::type>
+  AsyncDeleter(const AsyncDeleter<U>&) noexcept {}
+
+  void operator()(T* ptr) const noexcept {
+    AsyncDestroyPool::submit(
+        const_cast<void*>(static_cast<const void*>(ptr)), &destroy);
   }
-  return smart_ptr;
+
+ private:
+  static void destroy(void* ptr) noexcept { delete static_cast<T*>(ptr); }
+};
+
+template <typename T, typename... Args>
+SharedPtr<T> MakeSharedAsyncDestroy(Args&&... args) {
+  return SharedPtr<T>(new T(std::forward<Args>(args)...), AsyncDeleter<T>());
 }
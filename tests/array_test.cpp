@@ -0,0 +1,47 @@
+#include <cstdint>
+#include <new>
+#include <string>
+
+#include "check.hpp"
+#include "smart_pointers.hpp"
+
+namespace {
+
+template <typename Make>
+void CheckThrowsBadLength(Make make) {
+  bool thrown = false;
+  try {
+    make();
+  } catch (const std::bad_array_new_length&) {
+    thrown = true;
+  }
+  CHECK(thrown);
+}
+
+void TestSizeOverflowThrows() {
+  CheckThrowsBadLength([] { MakeShared<int[]>(SIZE_MAX / 4 + 2); });
+  CheckThrowsBadLength([] { MakeShared<int[]>(SIZE_MAX); });
+  CheckThrowsBadLength([] { MakeSharedForOverwrite<double[]>(SIZE_MAX / 8); });
+  CheckThrowsBadLength([] {
+    AllocateShared<std::string[]>(std::allocator<std::string>(), SIZE_MAX / 2,
+                                  std::string("x"));
+  });
+}
+
+void TestArrays() {
+  SharedPtr<int[]> values = MakeShared<int[]>(5, 7);
+  for (int i = 0; i < 5; ++i) {
+    CHECK(values[i] == 7);
+  }
+  SharedPtr<std::string[3]> strings = MakeShared<std::string[3]>();
+  strings[2] = "tail";
+  CHECK(strings[2] == "tail" && strings[0].empty());
+  CHECK(MakeShared<int[]>(0).use_count() == 1);
+}
+
+}  // namespace
+
+int main() {
+  TestSizeOverflowThrows();
+  TestArrays();
+}
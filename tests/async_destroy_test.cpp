@@ -0,0 +1,60 @@
+#include <atomic>
+#include <thread>
+
+#include "check.hpp"
+#include "smart_pointers.hpp"
+
+namespace {
+
+std::atomic<int> alive{0};
+
+struct Object {
+  Object() { ++alive; }
+  ~Object() { --alive; }
+};
+
+struct StopsPool {
+  ~StopsPool() { AsyncDestroyPool::shutdown(); }
+};
+
+struct ExitCheck {
+  ~ExitCheck() { CHECK(alive == 0); }
+} exit_check;
+
+SharedPtr<Object> late;
+
+void TestDestroyedOffThread() {
+  std::thread::id caller = std::this_thread::get_id();
+  std::atomic<bool> off_thread{false};
+  struct Probe {
+    Probe(std::thread::id caller, std::atomic<bool>* off_thread)
+        : caller(caller), off_thread(off_thread) {}
+    ~Probe() { *off_thread = std::this_thread::get_id() != caller; }
+    std::thread::id caller;
+    std::atomic<bool>* off_thread;
+  };
+  MakeSharedAsyncDestroy<Probe>(caller, &off_thread).reset();
+  for (int i = 0; i < 1000; ++i) {
+    MakeSharedAsyncDestroy<Object>().reset();
+  }
+  while (AsyncDestroyPool::stats().depth != 0) {
+    std::this_thread::yield();
+  }
+  CHECK(alive == 1);
+  CHECK(off_thread);
+}
+
+void TestShutdownFromWorker() {
+  MakeSharedAsyncDestroy<StopsPool>().reset();
+  MakeSharedAsyncDestroy<Object>().reset();
+  AsyncDestroyPool::shutdown();
+  CHECK(alive == 1);
+}
+
+}  // namespace
+
+int main() {
+  late = MakeSharedAsyncDestroy<Object>();
+  TestDestroyedOffThread();
+  TestShutdownFromWorker();
+}
@@ -0,0 +1,109 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "check.hpp"
+#include "smart_pointers.hpp"
+
+namespace {
+
+constexpr int kLive = 0x5eed;
+
+std::atomic<int> alive{0};
+
+struct Value {
+  explicit Value(int version) : version(version) { ++alive; }
+  ~Value() {
+    state = 0;
+    --alive;
+  }
+  int version;
+  int state = kLive;
+};
+
+void TestSingleThreaded() {
+  AtomicSharedPtr<Value> cell(MakeShared<Value>(1));
+  SharedPtr<Value> first = cell.load();
+  CHECK(first->version == 1 && first.use_count() == 2);
+  SharedPtr<Value> old = cell.exchange(MakeShared<Value>(2));
+  CHECK(old.get() == first.get() && first.use_count() == 2);
+  CHECK(cell.load()->version == 2);
+
+  SharedPtr<Value> expected = first;
+  CHECK(!cell.compare_exchange_strong(expected, MakeShared<Value>(3)));
+  CHECK(expected->version == 2 && expected.use_count() == 2);
+  CHECK(cell.compare_exchange_strong(expected, MakeShared<Value>(4)));
+  CHECK(expected.use_count() == 1 && cell.load()->version == 4);
+
+  cell.store(SharedPtr<Value>());
+  CHECK(cell.load().get() == nullptr);
+  SharedPtr<Value> empty;
+  CHECK(cell.compare_exchange_strong(empty, MakeShared<Value>(5)));
+  old = nullptr;
+  first = nullptr;
+  expected = nullptr;
+  CHECK(alive == 1);
+}
+
+void TestConcurrentLoadStore() {
+  AtomicSharedPtr<Value> cell(MakeShared<Value>(0));
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 4; ++t) {
+    readers.emplace_back([&] {
+      int last = 0;
+      while (!stop.load(std::memory_order_relaxed)) {
+        SharedPtr<Value> value = cell.load();
+        CHECK(value->state == kLive && value->version >= last);
+        CHECK(value.use_count() >= 1);
+        last = value->version;
+      }
+    });
+  }
+  for (int i = 1; i <= 5000; ++i) {
+    cell.store(MakeShared<Value>(i));
+  }
+  stop = true;
+  for (std::thread& reader : readers) {
+    reader.join();
+  }
+  CHECK(cell.load().use_count() == 2);
+  cell.store(SharedPtr<Value>());
+  CHECK(alive == 0);
+}
+
+void TestConcurrentCompareExchange() {
+  constexpr int kThreads = 4;
+  constexpr int kIncrements = 1000;
+  AtomicSharedPtr<Value> cell(MakeShared<Value>(0));
+  std::vector<std::thread> writers;
+  for (int t = 0; t < kThreads; ++t) {
+    writers.emplace_back([&] {
+      SharedPtr<Value> expected = cell.load();
+      for (int i = 0; i < kIncrements; ++i) {
+        while (!cell.compare_exchange_weak(
+            expected, MakeShared<Value>(expected->version + 1))) {
+          CHECK(expected->state == kLive);
+        }
+        expected = cell.load();
+      }
+    });
+  }
+  for (std::thread& writer : writers) {
+    writer.join();
+  }
+  SharedPtr<Value> last = cell.load();
+  CHECK(last->version == kThreads * kIncrements);
+  CHECK(last.use_count() == 2);
+  last = nullptr;
+  cell.store(SharedPtr<Value>());
+  CHECK(alive == 0);
+}
+
+}  // namespace
+
+int main() {
+  TestSingleThreaded();
+  TestConcurrentLoadStore();
+  TestConcurrentCompareExchange();
+}
@@ -0,0 +1,86 @@
+#include <atomic>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "check.hpp"
+#include "smart_pointers.hpp"
+
+namespace {
+
+std::atomic<int> alive{0};
+
+struct Object {
+  Object() { alive.fetch_add(1); }
+  ~Object() { alive.fetch_sub(1); }
+};
+
+void TestLockAfterExpiryOnOwner() {
+  SharedPtr<Object> owned = MakeSharedBiased<Object>();
+  WeakPtr<Object> weak(owned);
+  std::thread([moved = std::move(owned)]() mutable { moved = nullptr; })
+      .join();
+  CHECK(weak.expired());
+  CHECK(weak.lock().get() == nullptr);
+  CHECK(weak.lock().use_count() == 0);
+  CHECK(alive.load() == 0);
+}
+
+void TestLockAfterExpiryOnOtherThread() {
+  SharedPtr<Object> owned = MakeSharedBiased<Object>();
+  WeakPtr<Object> weak(owned);
+  SharedPtr<Object> copy = owned;
+  std::thread([moved = std::move(copy)]() mutable { moved = nullptr; })
+      .join();
+  std::thread([&] { CHECK(weak.lock().use_count() == 2); }).join();
+  owned = nullptr;
+  std::thread([&] { CHECK(weak.lock().get() == nullptr); }).join();
+  CHECK(alive.load() == 0);
+}
+
+void TestLockWhileOwnerHoldsAnother() {
+  SharedPtr<Object> owned = MakeSharedBiased<Object>();
+  WeakPtr<Object> weak(owned);
+  SharedPtr<Object> copy = owned;
+  std::thread([moved = std::move(copy)]() mutable { moved = nullptr; })
+      .join();
+  std::thread([&] {
+    SharedPtr<Object> locked = weak.lock();
+    CHECK(locked.get() == owned.get());
+  }).join();
+  CHECK(weak.lock().get() == owned.get());
+  CHECK(owned.use_count() == 1);
+}
+
+void TestConcurrentCopies() {
+  SharedPtr<Object> owned = MakeSharedBiased<Object>();
+  WeakPtr<Object> weak(owned);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([copy = owned, &weak]() mutable {
+      for (int i = 0; i < 10000; ++i) {
+        SharedPtr<Object> local = copy;
+        SharedPtr<Object> locked = weak.lock();
+        CHECK(locked.get() == copy.get());
+      }
+    });
+  }
+  for (int i = 0; i < 10000; ++i) {
+    SharedPtr<Object> local = owned;
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  CHECK(owned.use_count() == 1);
+  owned = nullptr;
+  CHECK(weak.expired() && alive.load() == 0);
+}
+
+}  // namespace
+
+int main() {
+  TestLockAfterExpiryOnOwner();
+  TestLockAfterExpiryOnOtherThread();
+  TestLockWhileOwnerHoldsAnother();
+  TestConcurrentCopies();
+}
@@ -0,0 +1,85 @@
+#include <memory_resource>
+
+#include "check.hpp"
+#include "smart_pointers.hpp"
+
+namespace {
+
+constexpr long kChainLength = 1000000;
+
+long alive = 0;
+
+template <typename Next>
+struct Node {
+  Node() { ++alive; }
+  ~Node() { --alive; }
+  Next next;
+};
+
+struct PlainNode : Node<SharedPtr<PlainNode>> {};
+struct ArrayNode : Node<SharedPtr<ArrayNode[]>> {};
+struct ThinNode : Node<ThinSharedPtr<ThinNode>> {};
+struct ShardedNode : Node<ShardedSharedPtr<ShardedNode>> {};
+struct LocalNode : Node<LocalSharedPtr<LocalNode>> {};
+struct RefNode : RefCountedBase, Node<SharedPtr<RefNode>> {};
+struct IntrusiveNode : RefCountedBase, Node<IntrusivePtr<IntrusiveNode>> {};
+
+struct NodeDeleter {
+  void operator()(PlainNode* node) const { delete node; }
+};
+
+template <typename Ptr, typename Make>
+void CheckChain(Make make) {
+  {
+    Ptr head;
+    for (long i = 0; i < kChainLength; ++i) {
+      Ptr node = make();
+      node->next = std::move(head);
+      head = std::move(node);
+    }
+    CHECK(alive == kChainLength);
+  }
+  CHECK(alive == 0);
+}
+
+void TestWeakPointersExpire() {
+  SharedPtr<PlainNode> head;
+  for (int i = 0; i < 1000; ++i) {
+    SharedPtr<PlainNode> node(new PlainNode);
+    node->next = std::move(head);
+    head = std::move(node);
+  }
+  WeakPtr<PlainNode> middle = head->next->next;
+  head.reset();
+  CHECK(middle.expired());
+  CHECK(alive == 0);
+}
+
+}  // namespace
+
+int main() {
+  CheckChain<SharedPtr<PlainNode>>(
+      [] { return SharedPtr<PlainNode>(new PlainNode); });
+  CheckChain<SharedPtr<PlainNode>>(
+      [] { return SharedPtr<PlainNode>(new PlainNode, NodeDeleter()); });
+  CheckChain<SharedPtr<PlainNode>>([] { return MakeShared<PlainNode>(); });
+  CheckChain<SharedPtr<PlainNode>>(
+      [] { return AllocateShared<PlainNode>(std::allocator<PlainNode>()); });
+  CheckChain<SharedPtr<PlainNode>>([] {
+    return AllocateSharedPmr<PlainNode>(std::pmr::new_delete_resource());
+  });
+  CheckChain<SharedPtr<PlainNode>>(
+      [] { return AllocateSharedAligned<PlainNode>(64); });
+  CheckChain<SharedPtr<PlainNode>>(
+      [] { return MakeSharedBiased<PlainNode>(); });
+  CheckChain<SharedPtr<ArrayNode[]>>([] { return MakeShared<ArrayNode[]>(1); });
+  CheckChain<ThinSharedPtr<ThinNode>>([] { return MakeSharedThin<ThinNode>(); });
+  CheckChain<ShardedSharedPtr<ShardedNode>>(
+      [] { return MakeSharedSharded<ShardedNode>(); });
+  CheckChain<LocalSharedPtr<LocalNode>>(
+      [] { return MakeLocalShared<LocalNode>(); });
+  CheckChain<SharedPtr<RefNode>>([] { return SharedPtr<RefNode>(new RefNode); });
+  CheckChain<IntrusivePtr<IntrusiveNode>>(
+      [] { return MakeIntrusive<IntrusiveNode>(); });
+  TestWeakPointersExpire();
+}
@@ -0,0 +1,91 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "check.hpp"
+#include "smart_pointers.hpp"
+
+namespace {
+
+std::atomic<int> alive{0};
+
+struct Object {
+  Object() { ++alive; }
+  ~Object() { --alive; }
+};
+
+SharedPtr<Object> MakeEpochObject() {
+  return SharedPtr<Object>(new Object, EpochDeleter<Object>());
+}
+
+void ReclaimAll() {
+  for (int i = 0; i < 3; ++i) {
+    EpochDomain::reclaim();
+  }
+}
+
+struct ExitCheck {
+  ~ExitCheck() { CHECK(alive == 0); }
+} exit_check;
+
+void TestDeferredUntilGracePeriod() {
+  SharedPtr<Object> ptr = MakeEpochObject();
+  WeakPtr<Object> weak = ptr;
+  {
+    EpochGuard guard;
+    ptr.reset();
+    CHECK(weak.expired());
+    ReclaimAll();
+    CHECK(alive == 1);
+  }
+  ReclaimAll();
+  CHECK(alive == 0);
+}
+
+void TestReleaseAfterThreadExit() {
+  std::thread([] {
+    thread_local SharedPtr<Object> late;
+    late = MakeEpochObject();
+    EpochGuard guard;
+    MakeEpochObject().reset();
+  }).join();
+  ReclaimAll();
+  CHECK(alive == 0);
+}
+
+void TestConcurrentReaders() {
+  std::atomic<Object*> published{nullptr};
+  SharedPtr<Object> owner = MakeEpochObject();
+  published = owner.get();
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 3; ++i) {
+    readers.emplace_back([&] {
+      while (!stop.load(std::memory_order_relaxed)) {
+        EpochGuard guard;
+        CHECK(published.load(std::memory_order_acquire) != nullptr);
+      }
+    });
+  }
+  for (int i = 0; i < 10000; ++i) {
+    SharedPtr<Object> next = MakeEpochObject();
+    published.store(next.get(), std::memory_order_release);
+    owner = std::move(next);
+  }
+  stop = true;
+  for (std::thread& reader : readers) {
+    reader.join();
+  }
+  owner.reset();
+  ReclaimAll();
+  CHECK(alive == 0);
+}
+
+}  // namespace
+
+int main() {
+  TestDeferredUntilGracePeriod();
+  TestReleaseAfterThreadExit();
+  TestConcurrentReaders();
+  MakeEpochObject().reset();
+}
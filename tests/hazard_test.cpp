@@ -0,0 +1,74 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "check.hpp"
+#include "smart_pointers.hpp"
+
+namespace {
+
+std::atomic<int> alive{0};
+
+struct Object {
+  explicit Object(int value) : value(value) { ++alive; }
+  ~Object() { --alive; }
+  int value;
+};
+
+struct ExitCheck {
+  ~ExitCheck() { CHECK(alive == 0); }
+} exit_check;
+
+void TestProtectDefersRelease() {
+  HazardSlot<Object> slot(MakeShared<Object>(1));
+  HazardPointer hazard;
+  Object* protected_ptr = hazard.protect(slot);
+  CHECK(protected_ptr->value == 1);
+  slot.store(MakeShared<Object>(2));
+  HazardDomain::reclaim();
+  CHECK(alive == 2 && protected_ptr->value == 1);
+  hazard.reset();
+  HazardDomain::reclaim();
+  CHECK(alive == 1 && slot.load()->value == 2);
+}
+
+void TestRetireAfterThreadExit() {
+  std::thread([] {
+    thread_local HazardSlot<Object> late(MakeShared<Object>(1));
+    for (int i = 0; i < 100; ++i) {
+      late.store(MakeShared<Object>(i));
+    }
+  }).join();
+  HazardDomain::reclaim();
+  CHECK(alive == 0);
+}
+
+void TestConcurrentReaders() {
+  HazardSlot<Object> slot(MakeShared<Object>(0));
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 4; ++t) {
+    readers.emplace_back([&] {
+      HazardPointer hazard;
+      while (!stop.load(std::memory_order_relaxed)) {
+        CHECK(hazard.protect(slot)->value >= 0);
+        hazard.reset();
+      }
+    });
+  }
+  for (int i = 1; i <= 20000; ++i) {
+    slot.store(MakeShared<Object>(i));
+  }
+  stop = true;
+  for (std::thread& reader : readers) {
+    reader.join();
+  }
+}
+
+}  // namespace
+
+int main() {
+  TestProtectDefersRelease();
+  TestRetireAfterThreadExit();
+  TestConcurrentReaders();
+}
@@ -0,0 +1,52 @@
+#include "check.hpp"
+#include "smart_pointers.hpp"
+
+namespace {
+
+int alive = 0;
+
+struct Object : RefCountedBase {
+  Object() { ++alive; }
+  ~Object() override { --alive; }
+};
+
+struct Derived : Object {};
+
+void TestSharedAndIntrusiveShareCounts() {
+  SharedPtr<Object> shared(new Derived);
+  CHECK(shared.use_count() == 1);
+  {
+    IntrusivePtr<Object> intrusive(shared.get());
+    CHECK(shared.use_count() == 2 && intrusive.use_count() == 2);
+  }
+  CHECK(shared.use_count() == 1);
+  shared = nullptr;
+  CHECK(alive == 0);
+}
+
+void TestIntrusiveLifetime() {
+  IntrusivePtr<Object> first = MakeIntrusive<Derived>();
+  IntrusivePtr<Object> second = first;
+  CHECK(first.use_count() == 2 && alive == 1);
+  first = nullptr;
+  CHECK(alive == 1);
+  second = nullptr;
+  CHECK(alive == 0);
+}
+
+void TestNullPointer() {
+  SharedPtr<Object> shared(static_cast<Object*>(nullptr));
+  CHECK(shared.get() == nullptr && shared.use_count() == 0);
+  shared = SharedPtr<Object>(new Object);
+  CHECK(shared.use_count() == 1 && alive == 1);
+  shared = nullptr;
+  CHECK(alive == 0);
+}
+
+}  // namespace
+
+int main() {
+  TestSharedAndIntrusiveShareCounts();
+  TestIntrusiveLifetime();
+  TestNullPointer();
+}
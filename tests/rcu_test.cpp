@@ -0,0 +1,84 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "check.hpp"
+#include "smart_pointers.hpp"
+
+namespace {
+
+constexpr int kLive = 0x5eed;
+
+std::atomic<int> alive{0};
+
+struct Config {
+  explicit Config(int version) : version(version) { ++alive; }
+  Config(const Config& other) : version(other.version) { ++alive; }
+  ~Config() {
+    state = 0;
+    --alive;
+  }
+  int version;
+  int state = kLive;
+};
+
+void TestStoreAndUpdate() {
+  RcuCell<Config> cell(MakeShared<Config>(1));
+  CHECK(cell.read()->version == 1);
+  cell.store(MakeShared<Config>(2));
+  CHECK(cell.load()->version == 2);
+  cell.update([](Config& config) { ++config.version; });
+  CHECK(cell.read()->version == 3);
+}
+
+void TestOldSnapshotsAreFreed() {
+  RcuCell<Config> cell(MakeShared<Config>(0));
+  for (int i = 1; i <= 40; ++i) {
+    cell.update([](Config& config) { ++config.version; });
+  }
+  CHECK(alive == 1);
+  {
+    RcuCell<Config>::Snapshot snapshot = cell.read();
+    cell.store(MakeShared<Config>(100));
+    CHECK(alive == 2 && snapshot->state == kLive);
+  }
+  cell.store(MakeShared<Config>(101));
+  CHECK(alive == 1);
+}
+
+void TestReadersSeeLiveSnapshots() {
+  RcuCell<Config> cell(MakeShared<Config>(0));
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 4; ++t) {
+    readers.emplace_back([&] {
+      int last = 0;
+      while (!stop.load(std::memory_order_relaxed)) {
+        RcuCell<Config>::Snapshot snapshot = cell.read();
+        CHECK(snapshot->state == kLive);
+        CHECK(snapshot->version >= last);
+        last = snapshot->version;
+      }
+    });
+  }
+  for (int i = 1; i <= 20000; ++i) {
+    if (i % 2 == 0) {
+      cell.store(MakeShared<Config>(i));
+    } else {
+      cell.update([i](Config& config) { config.version = i; });
+    }
+  }
+  stop = true;
+  for (std::thread& reader : readers) {
+    reader.join();
+  }
+  CHECK(cell.read()->version == 20000);
+}
+
+}  // namespace
+
+int main() {
+  TestStoreAndUpdate();
+  TestOldSnapshotsAreFreed();
+  TestReadersSeeLiveSnapshots();
+}
@@ -0,0 +1,58 @@
+#include <string>
+
+#include "check.hpp"
+#include "smart_pointers.hpp"
+
+namespace {
+
+struct Parent;
+
+struct Child {
+  ~Child();
+  Parent* parent = nullptr;
+  std::string seen;
+};
+
+struct Parent {
+  std::string name = "parent with a name too long for small strings";
+  SharedPtr<Child> child;
+};
+
+std::string last_seen;
+
+Child::~Child() { last_seen = parent->name; }
+
+void TestChildSeesParentMembers() {
+  SharedPtr<Parent> parent = MakeShared<Parent>();
+  parent->child = MakeShared<Child>();
+  parent->child->parent = parent.get();
+  parent = nullptr;
+  CHECK(last_seen == "parent with a name too long for small strings");
+}
+
+int destroyed = 0;
+bool destroyed_before_return = false;
+
+struct Counted {
+  ~Counted() { ++destroyed; }
+};
+
+struct Resetter {
+  ~Resetter() {
+    held.reset();
+    destroyed_before_return = destroyed == 1;
+  }
+  SharedPtr<Counted> held = MakeShared<Counted>();
+};
+
+void TestResetInsideDestructor() {
+  MakeShared<Resetter>().reset();
+  CHECK(destroyed_before_return);
+}
+
+}  // namespace
+
+int main() {
+  TestChildSeesParentMembers();
+  TestResetInsideDestructor();
+}
@@ -0,0 +1,48 @@
+#include <memory>
+
+#include "check.hpp"
+#include "smart_pointers.hpp"
+
+namespace {
+
+struct Widget : EnableSharedFromThis<Widget> {
+  int value = 5;
+};
+
+void CheckSharesOwnership(const SharedPtr<Widget>& owner) {
+  SharedPtr<Widget> self = owner->SharedFromThis();
+  CHECK(self.get() == owner.get());
+  CHECK(owner.use_count() == 2);
+  const Widget& constant = *owner;
+  SharedPtr<const Widget> const_self = constant.SharedFromThis();
+  CHECK(const_self->value == 5 && owner.use_count() == 3);
+}
+
+void TestSharedFromThis() {
+  CheckSharesOwnership(MakeShared<Widget>());
+  CheckSharesOwnership(SharedPtr<Widget>(new Widget));
+  CheckSharesOwnership(AllocateShared<Widget>(std::allocator<Widget>()));
+}
+
+void TestWeakFromThisExpires() {
+  SharedPtr<Widget> owner = MakeShared<Widget>();
+  WeakPtr<Widget> weak = owner->WeakFromThis();
+  CHECK(!weak.expired() && weak.lock().get() == owner.get());
+  owner = nullptr;
+  CHECK(weak.expired());
+  CHECK(weak.lock().get() == nullptr);
+}
+
+void TestUnownedObject() {
+  Widget widget;
+  CHECK(widget.WeakFromThis().expired());
+  CHECK(widget.SharedFromThis().get() == nullptr);
+}
+
+}  // namespace
+
+int main() {
+  TestSharedFromThis();
+  TestWeakFromThisExpires();
+  TestUnownedObject();
+}
@@ -0,0 +1,74 @@
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "check.hpp"
+#include "smart_pointers.hpp"
+
+namespace {
+
+template <typename T>
+struct CountingAllocator {
+  using value_type = T;
+
+  CountingAllocator() = default;
+  template <typename U>
+  CountingAllocator(const CountingAllocator<U>&) noexcept {}
+
+  T* allocate(size_t n) {
+    ++allocations;
+    return std::allocator<T>().allocate(n);
+  }
+  void deallocate(T* ptr, size_t n) noexcept {
+    --allocations;
+    std::allocator<T>().deallocate(ptr, n);
+  }
+
+  static inline int allocations = 0;
+};
+
+template <typename T, typename U>
+bool operator==(const CountingAllocator<T>&, const CountingAllocator<U>&) {
+  return true;
+}
+template <typename T, typename U>
+bool operator!=(const CountingAllocator<T>&, const CountingAllocator<U>&) {
+  return false;
+}
+
+struct alignas(32) Wide {
+  explicit Wide(int value) : value(value) {}
+  int value;
+};
+
+template <typename T, typename Alloc, typename... Args>
+void CheckThin(const Alloc& alloc, Args&&... args) {
+  ThinSharedPtr<T> thin =
+      AllocateSharedThin<T>(alloc, std::forward<Args>(args)...);
+  SharedPtr<T> shared = thin.share();
+  CHECK(shared.get() == thin.get());
+  CHECK(reinterpret_cast<uintptr_t>(thin.get()) % alignof(T) == 0);
+  CHECK(thin.use_count() == 2);
+}
+
+void TestCustomAllocator() {
+  CheckThin<std::string>(CountingAllocator<std::string>(), "thin");
+  CheckThin<char>(CountingAllocator<char>(), 'x');
+  CheckThin<Wide>(CountingAllocator<Wide>(), 7);
+  CHECK(CountingAllocator<char>::allocations == 0);
+}
+
+void TestDefaultAllocator() {
+  ThinSharedPtr<std::string> thin = MakeSharedThin<std::string>("value");
+  CHECK(*thin == "value");
+  ThinSharedPtr<std::string> copy = thin;
+  CHECK(copy.get() == thin.get() && copy.use_count() == 2);
+  CheckThin<Wide>(std::allocator<Wide>(), 3);
+}
+
+}  // namespace
+
+int main() {
+  TestCustomAllocator();
+  TestDefaultAllocator();
+}
@@ -0,0 +1,46 @@
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "check.hpp"
+#include "smart_pointers.hpp"
+
+namespace {
+
+struct Item {
+  explicit Item(long value) : value(value) {}
+  long value;
+};
+
+template <typename Ptr>
+struct Holder {
+  std::vector<Ptr> items;
+};
+
+void TestSlabFreesAfterCacheExit() {
+  using Ptr = SharedPtr<Item>;
+  std::thread([] {
+    thread_local Holder<Ptr> holder;
+    holder.items.reserve(300);
+    for (long i = 0; i < 300; ++i) {
+      holder.items.push_back(AllocateShared<Item>(SlabAllocator<Item>(), i));
+    }
+  }).join();
+  for (int round = 0; round < 4; ++round) {
+    std::thread([] {
+      std::vector<Ptr> items;
+      std::set<Item*> seen;
+      for (long i = 0; i < 1000; ++i) {
+        items.push_back(AllocateShared<Item>(SlabAllocator<Item>(), i));
+        CHECK(seen.insert(items.back().get()).second);
+      }
+      for (long i = 0; i < 1000; ++i) {
+        CHECK(items[i]->value == i);
+      }
+    }).join();
+  }
+}
+
+}  // namespace
+
+int main() { TestSlabFreesAfterCacheExit(); }
@@ -0,0 +1,38 @@
+#include "check.hpp"
+#include "smart_pointers.hpp"
+
+namespace {
+
+struct Tree {
+  WeakPtr<Tree> parent;
+  SharedPtr<Tree> child;
+};
+
+struct Forward;
+
+struct HoldsForward {
+  WeakPtr<Forward> forward;
+};
+
+struct Forward {
+  int value = 3;
+};
+
+void TestIncompleteWeakMember() {
+  SharedPtr<Tree> root = MakeShared<Tree>();
+  root->child = MakeShared<Tree>();
+  root->child->parent = root;
+  CHECK(root->child->parent.lock().get() == root.get());
+  WeakPtr<Tree> weak = root;
+  root = nullptr;
+  CHECK(weak.expired());
+
+  HoldsForward holder;
+  SharedPtr<Forward> forward = MakeShared<Forward>();
+  holder.forward = forward;
+  CHECK(holder.forward.lock()->value == 3);
+}
+
+}  // namespace
+
+int main() { TestIncompleteWeakMember(); }